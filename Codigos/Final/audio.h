@@ -0,0 +1,119 @@
+/****************************************************************************
+  Som do emulador Chip-8.
+
+  O Chip-8 tem um único som: um tom contínuo enquanto o timer de som é maior
+  que zero. Tone gera esse tom (uma onda quadrada) a cada tick dos timers, ou
+  seja, em blocos de 1/60s: o bloco é tom se o timer de som contou no tick
+  (Chip8::beep) e silêncio caso contrário. A fase da onda continua de um bloco
+  para o outro, então um som longo não tem estalos entre os quadros.
+
+  As amostras vão para um buffer circular lido pela thread de áudio do
+  frontend (um produtor e um consumidor, sem travas). Se a emulação gera áudio
+  mais rápido que o tempo real (--max-speed), os blocos que passariam da
+  latência configurada são descartados; se gera mais devagar, a thread de áudio
+  completa com silêncio. Sem consumidor (emulador headless ou som desligado),
+  Tone funciona como backend nulo: conta os ticks e descarta o áudio.
+*****************************************************************************/
+
+#ifndef CHIP8_AUDIO_H
+#define CHIP8_AUDIO_H
+
+#include <atomic>
+#include <vector>
+#include "chip8.h"
+
+const unsigned audioRate = 44100;     //amostras por segundo
+const unsigned toneHz    = 440;       //frequência do tom
+const int16_t  toneLevel = 6000;      //amplitude da onda quadrada
+
+class Tone {
+public:
+    unsigned long ticks;              //ticks recebidos
+    unsigned long toneTicks;          //ticks com o tom ligado
+    unsigned long dropped;            //blocos descartados por excesso de latência
+    unsigned long underruns;          //leituras completadas com silêncio
+
+    //latency: áudio máximo no buffer, em milissegundos
+    explicit Tone(unsigned latency);
+
+    void   tick(bool on);
+    size_t read(int16_t* out, size_t count);
+    void   setStreaming(bool on) { streaming = on; }
+
+    size_t latencySamples() const { return limit; }
+
+private:
+    std::vector<int16_t> ring;
+    size_t               mask;
+    std::atomic<size_t>  head;        //escrito pela emulação
+    std::atomic<size_t>  tail;        //escrito pela thread de áudio
+    size_t               limit;       //amostras no buffer, no máximo
+    bool                 streaming;   //há uma thread de áudio lendo o buffer
+    unsigned             phase;       //posição na onda, em 1/audioRate de período
+    unsigned             fraction;    //resto de audioRate/TIMER_HZ acumulado entre os ticks
+};
+
+inline Tone::Tone(unsigned latency) : ticks(0), toneTicks(0), dropped(0), underruns(0),
+                                      head(0), tail(0), streaming(false), phase(0), fraction(0) {
+    limit = (size_t) audioRate * latency / 1000;
+    if (limit < audioRate / TIMER_HZ) {
+        limit = audioRate / TIMER_HZ; //pelo menos um bloco
+    }
+
+    //capacidade: potência de 2 com folga para um bloco além do limite
+    size_t capacity = 1;
+    while (capacity < limit + audioRate / TIMER_HZ + 1) {
+        capacity <<= 1;
+    }
+    ring.resize(capacity);
+    mask = capacity - 1;
+}
+
+/* Produz o áudio de um tick dos timers (1/60s): tom se on, silêncio caso contrário */
+inline void Tone::tick(bool on) {
+    ticks++;
+    toneTicks += on;
+
+    //audioRate/TIMER_HZ amostras, com o resto distribuído entre os ticks
+    fraction += audioRate;
+    size_t samples = fraction / TIMER_HZ;
+    fraction %= TIMER_HZ;
+
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t buffered = h - tail.load(std::memory_order_acquire);
+    if (!streaming || buffered + samples > limit) {
+        //backend nulo ou buffer cheio: o bloco é descartado, mas a onda segue
+        dropped += streaming;
+        phase = (phase + samples * toneHz) % audioRate;
+        return;
+    }
+
+    for (size_t i = 0; i < samples; i++) {
+        ring[(h + i) & mask] = on ? (phase < audioRate / 2 ? toneLevel : -toneLevel) : 0;
+        phase += toneHz;
+        if (phase >= audioRate) {
+            phase -= audioRate;
+        }
+    }
+    head.store(h + samples, std::memory_order_release);
+}
+
+/* Lê count amostras (thread de áudio); o que faltar é completado com silêncio */
+inline size_t Tone::read(int16_t* out, size_t count) {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t available = head.load(std::memory_order_acquire) - t;
+    size_t n = (available < count) ? available : count;
+
+    for (size_t i = 0; i < n; i++) {
+        out[i] = ring[(t + i) & mask];
+    }
+    for (size_t i = n; i < count; i++) {
+        out[i] = 0;
+    }
+    tail.store(t + n, std::memory_order_release);
+
+    underruns += (n < count);
+    return n;
+}
+
+#endif
@@ -0,0 +1,445 @@
+/****************************************************************************
+  Execução em lote (lockstep) de várias máquinas Chip-8 com a mesma ROM.
+
+  Usado para fuzzing e buscas: a mesma ROM roda em N "lanes", cada uma com sua
+  semente e seu teclado. Os registradores (V, I, PC, SP, pilha e timers) das N
+  lanes ficam em structure-of-arrays: V[x] é um vetor com o Vx de cada lane.
+
+  Enquanto todas as lanes ativas estão no mesmo PC e com a mesma instrução, as
+  instruções de registradores (LD, ADD, OR, AND, XOR, SUB, SHR, SHL, SE, SNE,
+  JP, CALL, RET, LD I, ADD I, LD F e as de timers) são executadas por laços simples
+  sobre as lanes, que o compilador vetoriza com -O3 (SSE2, ou AVX2 com
+  -march=native).
+  As demais instruções usam o interpretador de cada lane: os registradores são
+  copiados para a máquina da lane, a instrução é executada com step() e o
+  resultado volta para os vetores. Quando as lanes divergem (PCs diferentes),
+  cada uma executa o resto do quadro sozinha; no quadro seguinte o lote volta
+  a tentar o caminho vetorial.
+
+  A memória, a tela, o teclado e a semente ficam na máquina de cada lane (as
+  páginas da memória são compartilhadas com a máquina modelo até a primeira
+  escrita); os registradores só são copiados de volta para ela quando lane() é
+  chamado.
+  Todas as lanes executam o mesmo número de instruções, então o escalonador
+  (os ticks dos timers a 60hz de tempo emulado) é um só para o lote.
+*****************************************************************************/
+
+#ifndef CHIP8_BATCH_H
+#define CHIP8_BATCH_H
+
+#include <vector>
+#include "chip8.h"
+
+//percorre as lanes (laços que o compilador vetoriza); n é lido uma única vez, pois as
+//escritas em vetores de bytes poderiam alterá-lo e impediriam a vetorização
+#define FOR_LANES for (int l = 0, end = n; l < end; l++)
+
+class Batch {
+public:
+    unsigned long long uniformSteps;  //instruções executadas em todas as lanes de uma vez
+    unsigned long long scalarSteps;   //instruções executadas por uma lane isolada
+
+    Batch(const Chip8& prototype, int lanes);
+
+    int    size() const { return n; }
+    Chip8& lane(int i);
+
+    int  run(int cycles);
+    int  runFrame();
+    int  cyclesToTick() const;
+
+private:
+    int n;
+    unsigned clockHz;             //da máquina modelo
+    unsigned timerPhase;          //como em Chip8, comum a todas as lanes
+    int      chunkDone;           //instruções já executadas no trecho atual de run()
+    std::vector<Chip8> lanes;     //estado completo de cada lane entre quadros
+
+    //registradores das lanes (structure-of-arrays)
+    std::vector<byte> V[16];
+    std::vector<word> I, PC, SP;
+    std::vector<word> stack[stackLevels];
+    std::vector<byte> delayTimer, soundTimer;
+    std::vector<byte> active;     //a lane ainda está executando (RUNNING)
+    std::vector<byte> beep;
+
+    bool sharedCode;              //a memória de todas as lanes ainda é idêntica
+
+    void gather(int l);           //máquina da lane -> vetores
+    void scatter(int l);          //vetores -> máquina da lane
+    void runLane(int l, int cycles);
+    bool sameWrite(int first, byte op, byte x) const;
+    bool executeUniform(const Instr& in);
+    int  step(int cycles);
+    void tickTimers();
+};
+
+inline Batch::Batch(const Chip8& prototype, int count) : uniformSteps(0), scalarSteps(0), n(count),
+                                                         clockHz(prototype.clockHz),
+                                                         timerPhase(prototype.timerPhase), chunkDone(0),
+                                                         lanes(count, prototype), sharedCode(true) {
+    for (int i = 0; i <= 0xF; i++) {
+        V[i].resize(n);
+    }
+    for (int i = 0; i < stackLevels; i++) {
+        stack[i].resize(n);
+    }
+    for (int l = 0; l < n; l++) {
+        lanes[l].trace = NULL;
+        lanes[l].traceFile = NULL;
+    }
+
+    I.resize(n);
+    PC.resize(n);
+    SP.resize(n);
+    delayTimer.resize(n);
+    soundTimer.resize(n);
+    active.resize(n);
+    beep.resize(n);
+
+    for (int l = 0; l < n; l++) {
+        active[l] = (lanes[l].status == Chip8::RUNNING);
+        gather(l);
+    }
+}
+
+/*  Máquina da lane i, com os registradores atualizados. Teclado e semente podem ser
+ *  alterados entre quadros; alterações nos registradores são ignoradas.
+ */
+inline Chip8& Batch::lane(int i) {
+    if (active[i]) {
+        scatter(i);
+        lanes[i].beep = beep[i];
+        lanes[i].timerPhase = timerPhase;
+    }
+    return lanes[i];
+}
+
+inline void Batch::gather(int l) {
+    const Chip8& c = lanes[l];
+    for (int i = 0; i <= 0xF; i++) {
+        V[i][l] = c.V[i];
+    }
+    for (int i = 0; i < stackLevels; i++) {
+        stack[i][l] = c.stack[i];
+    }
+    I[l]  = c.I;
+    PC[l] = c.PC;
+    SP[l] = c.SP;
+    delayTimer[l] = c.delayTimer;
+    soundTimer[l] = c.soundTimer;
+}
+
+inline void Batch::scatter(int l) {
+    Chip8& c = lanes[l];
+    for (int i = 0; i <= 0xF; i++) {
+        c.V[i] = V[i][l];
+    }
+    for (int i = 0; i < stackLevels; i++) {
+        c.stack[i] = stack[i][l];
+    }
+    c.I  = I[l];
+    c.PC = PC[l];
+    c.SP = SP[l];
+    c.delayTimer = delayTimer[l];
+    c.soundTimer = soundTimer[l];
+}
+
+/* Executa até cycles instruções apenas na lane l, com o interpretador da própria lane */
+inline void Batch::runLane(int l, int cycles) {
+    Chip8& c = lanes[l];
+    scatter(l);
+
+    NoTrace none;
+    int done = 0;
+    while (done < cycles && c.status == Chip8::RUNNING) {
+        //uma escrita na memória pode deixar esta lane com um código diferente das outras
+        if (sharedCode) {
+            word addr = c.PC & memMask;
+            byte op = opIndex((c.memory[addr] << 8) | c.memory[(addr + 1) & memMask]);
+            sharedCode = (op != OP_LD_B && op != OP_LD_I_VX);
+        }
+        c.execute(none);
+        done++;
+    }
+
+    //LD Vx, K sem tecla: a lane repete a instrução no próximo passo, como no interpretador antigo
+    if (c.status == Chip8::WAITING) {
+        c.status = Chip8::RUNNING;
+    }
+
+    gather(l);
+    if (c.status != Chip8::RUNNING) {
+        //a máquina da lane guarda o estado final, com o tempo até a instrução que a parou
+        active[l] = 0;
+        c.beep = beep[l];
+        c.timerPhase = timerPhase;
+        c.advanceClock(chunkDone + done);
+    }
+    scalarSteps += done;
+}
+
+/* As escritas na memória de LD B e LD [I] serão idênticas em todas as lanes? */
+inline bool Batch::sameWrite(int first, byte op, byte x) const {
+    int low = (op == OP_LD_B) ? x : 0; //LD B escreve só Vx; LD [I] escreve V0-Vx
+    for (int l = first + 1; l < n; l++) {
+        if (!active[l]) {
+            continue;
+        }
+        if (I[l] != I[first]) {
+            return false;
+        }
+        for (int i = low; i <= x; i++) {
+            if (V[i][l] != V[i][first]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/*  Executa a instrução em todas as lanes de uma vez. Os valores de lanes inativas
+ *  também são alterados, mas nunca voltam para a máquina da lane.
+ *  Retorna false se a instrução não tem versão vetorial.
+ */
+inline bool Batch::executeUniform(const Instr& in) {
+    byte* vx = V[in.x].data();
+    byte* vy = V[in.y].data();
+    byte* vf = V[0xF].data();
+    word* pc = PC.data();
+    word* sp = SP.data();
+    word* ri = I.data();
+    byte  kk = in.kk;
+    word  nnn = in.nnn;
+
+    //PC += 2 (o interpretador atualiza o PC antes de executar)
+    FOR_LANES pc[l] += 2;
+
+    switch (opIndex(in.instr)) {
+        case OP_SYS:
+            break;
+        case OP_JP:
+            FOR_LANES pc[l] = nnn;
+            break;
+        case OP_CALL:
+            FOR_LANES stack[sp[l]][l] = pc[l];
+            FOR_LANES sp[l] = (sp[l] + 1) & (stackLevels - 1);
+            FOR_LANES pc[l] = nnn;
+            break;
+        case OP_RET:
+            FOR_LANES sp[l] = (sp[l] - 1) & (stackLevels - 1);
+            FOR_LANES pc[l] = stack[sp[l]][l];
+            break;
+        case OP_SE_BYTE:
+            FOR_LANES pc[l] += (vx[l] == kk) << 1;
+            break;
+        case OP_SNE_BYTE:
+            FOR_LANES pc[l] += (vx[l] != kk) << 1;
+            break;
+        case OP_SE_REG:
+            FOR_LANES pc[l] += (vx[l] == vy[l]) << 1;
+            break;
+        case OP_SNE_REG:
+            FOR_LANES pc[l] += (vx[l] != vy[l]) << 1;
+            break;
+        case OP_LD_BYTE:
+            FOR_LANES vx[l] = kk;
+            break;
+        case OP_ADD_BYTE:
+            FOR_LANES vx[l] += kk;
+            break;
+        case OP_LD_REG:
+            FOR_LANES vx[l] = vy[l];
+            break;
+        case OP_OR:
+            FOR_LANES vx[l] |= vy[l];
+            break;
+        case OP_AND:
+            FOR_LANES vx[l] &= vy[l];
+            break;
+        case OP_XOR:
+            FOR_LANES vx[l] ^= vy[l];
+            break;
+        //VF é escrito antes de Vx, como no interpretador (importa quando x ou y é F)
+        case OP_ADD_REG:
+            FOR_LANES {
+                word tmp = vx[l] + vy[l];
+                vf[l] = (tmp >> 8);
+                vx[l] = tmp;
+            }
+            break;
+        case OP_SUB:
+            FOR_LANES {
+                word tmp = vx[l] - vy[l];
+                vf[l] = !(tmp >> 8);
+                vx[l] = tmp;
+            }
+            break;
+        case OP_SUBN:
+            FOR_LANES {
+                word tmp = vy[l] - vx[l];
+                vf[l] = !(tmp >> 8);
+                vx[l] = tmp;
+            }
+            break;
+        case OP_SHR:
+            FOR_LANES {
+                vf[l] = vy[l] & 1;
+                vx[l] = vy[l] << 1;
+            }
+            break;
+        case OP_SHL:
+            FOR_LANES {
+                vf[l] = vy[l] >> 7;
+                vx[l] = vy[l] >> 1;
+            }
+            break;
+        case OP_LD_I:
+            FOR_LANES ri[l] = nnn;
+            break;
+        case OP_ADD_I:
+            FOR_LANES ri[l] += vx[l];
+            break;
+        case OP_LD_F:
+            FOR_LANES ri[l] = vx[l] * 0x5;
+            break;
+        case OP_LD_VX_DT:
+            FOR_LANES vx[l] = delayTimer[l];
+            break;
+        case OP_LD_DT:
+            FOR_LANES delayTimer[l] = vx[l];
+            break;
+        case OP_LD_ST:
+            FOR_LANES soundTimer[l] = vx[l];
+            break;
+        default:
+            FOR_LANES pc[l] -= 2;
+            return false;
+    }
+
+    uniformSteps++;
+    return true;
+}
+
+/* Um tick dos timers em todas as lanes, como em Chip8::tickTimers() */
+inline void Batch::tickTimers() {
+    byte* dt = delayTimer.data();
+    byte* st = soundTimer.data();
+    byte* bp = beep.data();
+    FOR_LANES dt[l] -= (dt[l] != 0);
+    FOR_LANES bp[l] |= (st[l] != 0);
+    FOR_LANES st[l] -= (st[l] != 0);
+}
+
+/*  Executa uma instrução em todas as lanes ativas ou, se elas divergiram, as cycles
+ *  instruções restantes do quadro em cada uma. Retorna quantos ciclos foram executados.
+ */
+inline int Batch::step(int cycles) {
+    int first = 0;
+    while (first < n && !active[first]) {
+        first++;
+    }
+    if (first == n) {
+        return 0;
+    }
+
+    //todas as lanes ativas estão no mesmo PC?
+    const word* pc = PC.data();
+    const byte* on = active.data();
+    word target = pc[first];
+    byte diverged = 0;
+    FOR_LANES diverged |= on[l] & (pc[l] != target);
+
+    if (!diverged) {
+        Chip8& c = lanes[first];
+        Instr tmp;
+        const Instr& in = c.fetch(target, tmp);
+
+        //com memórias diferentes, a instrução pode ser outra em alguma lane
+        bool sameInstr = sharedCode;
+        if (!sameInstr) {
+            word addr = target & memMask, next = (target + 1) & memMask;
+            byte hi = c.memory[addr], lo = c.memory[next];
+            sameInstr = true;
+            for (int l = first + 1; l < n; l++) {
+                if (on[l] && (lanes[l].memory[addr] != hi || lanes[l].memory[next] != lo)) {
+                    sameInstr = false;
+                    break;
+                }
+            }
+        }
+
+        if (sameInstr) {
+            if (executeUniform(in)) {
+                return 1;
+            }
+
+            //as escritas na memória mantêm as lanes iguais se todas escrevem o mesmo
+            byte op = opIndex(in.instr);
+            bool shared = sharedCode && ((op != OP_LD_B && op != OP_LD_I_VX) || sameWrite(first, op, in.x));
+            for (int l = first; l < n; l++) {
+                if (active[l]) {
+                    runLane(l, 1);
+                }
+            }
+            sharedCode = shared;
+            return 1;
+        }
+    }
+
+    //lanes divergentes: cada uma executa sozinha o resto do quadro
+    for (int l = first; l < n; l++) {
+        if (active[l]) {
+            runLane(l, cycles);
+        }
+    }
+    return cycles;
+}
+
+/* Instruções até o próximo tick dos timers, como em Chip8::cyclesToTick() */
+inline int Batch::cyclesToTick() const {
+    int cycles = (clockHz - timerPhase + TIMER_HZ - 1) / TIMER_HZ;
+    return (cycles > 0) ? cycles : 1;
+}
+
+/* Executa até cycles instruções em todas as lanes, com os timers; retorna quantas rodaram */
+inline int Batch::run(int cycles) {
+    int done = 0;
+
+    while (done < cycles) {
+        int chunk = cyclesToTick();
+        if (chunk > cycles - done) {
+            chunk = cycles - done;
+        }
+
+        for (chunkDone = 0; chunkDone < chunk; ) {
+            int executed = step(chunk - chunkDone);
+            if (executed == 0) {
+                break; //nenhuma lane ativa
+            }
+            chunkDone += executed;
+        }
+        if (chunkDone == 0) {
+            break;
+        }
+
+        timerPhase += chunkDone * TIMER_HZ;
+        while (timerPhase >= clockHz) {
+            timerPhase -= clockHz;
+            tickTimers();
+        }
+        done += chunkDone;
+    }
+
+    return done;
+}
+
+/* Executa um quadro (1/60s) em todas as lanes; retorna quantos ciclos rodaram */
+inline int Batch::runFrame() {
+    memset(beep.data(), 0, n);
+    return run(cyclesToTick());
+}
+
+#undef FOR_LANES
+
+#endif
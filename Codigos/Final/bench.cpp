@@ -0,0 +1,480 @@
+/****************************************************************************
+  Benchmark do emulador Chip-8.
+
+  Executa cada ROM de um diretório em cada motor, sem janela, por um número
+  fixo de quadros, com o mesmo roteiro de teclas e a mesma semente, e mede:
+  - instruções emuladas por segundo (MIPS) e nanossegundos por instrução, o
+    melhor tempo de --repeat execuções (a primeira inclui a compilação do JIT);
+  - a distribuição das instruções executadas por Op, medida em uma execução à
+    parte, instrução por instrução, no interpretador (não entra no tempo);
+  - o pico de memória residente (RSS) do processo.
+  As instruções contadas são as do tempo emulado, como em run(): as de espera
+  por tecla (LD Vx, K), que não chegam a ser executadas, também contam.
+
+  O resultado sai em tabela e, com --json, também em JSON. Com --baseline, cada
+  par ROM/motor é comparado com um JSON gravado antes; se algum ficou mais lento
+  que o limite (--threshold), o benchmark termina com 1.
+
+COMPILE:
+"./build.sh" (gera também o executável bench)
+
+EXECUTE:
+"./bench [opções]"
+
+OPÇÕES:
+--roms dir         diretório das ROMs (padrão: roms)
+--frames N         quadros por execução (padrão: 600, 10 segundos emulados)
+--clock N          instruções por segundo de tempo emulado (padrão: 500000)
+--seed N           semente dos números aleatórios (padrão: 1)
+--keys arquivo     roteiro de teclas (keyscript.h); sem ele, cada tecla de 0 a F é
+                   segurada por 10 quadros, uma a cada 30 quadros
+--engine nome      cached, threaded ou jit; pode ser repetida (padrão: os três)
+--repeat N         execuções medidas por ROM e motor (padrão: 3)
+--idle-skip        pula os laços ociosos, como o emulador (padrão: desligado, para
+                   medir a velocidade dos motores e não a dos laços das ROMs; a busca
+                   pelos laços usa sempre o interpretador, em qualquer motor)
+--json arq         grava o resultado em JSON em arq ("-": saída padrão)
+--baseline arq     JSON de uma execução anterior, para comparar
+--threshold pct    queda de MIPS tolerada em relação ao baseline (padrão: 10)
+
+JSON:
+Um objeto com a configuração, o pico de RSS, uma linha por par ROM/motor em
+"results" e uma linha por ROM em "mix":
+    {"rom": "PONG", "engine": "cached", "mips": 123.456, "ns_per_instr": 8.100, ...}
+    {"rom": "PONG", "instructions": 3000000, "ops": {"CLS": 0, "RET": 1520, ...}}
+--baseline lê apenas as linhas de "results", no formato acima.
+*****************************************************************************/
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "chip8.h"
+#include "keyscript.h"
+#include "farm.h"
+
+//opções
+const char*      romDir     = "roms";
+unsigned long    maxFrames  = 600;
+unsigned         clockHz    = 500000;
+unsigned         seed       = 1;
+const char*      keysFile   = NULL;
+std::vector<int> engines;
+int              repeat     = 3;
+bool             idleSkip   = false;
+const char*      jsonName   = NULL;
+const char*      baselineName = NULL;
+double           threshold  = 10;
+
+const char* engineNames[] = {"cached", "threaded", "jit"};
+const char* statusNames[] = {"running", "exited", "crashed"};
+
+//roteiro de teclas usado em todas as execuções
+KeyScript script;
+
+//medida de uma ROM em um motor
+struct BenchResult {
+    std::string   rom;
+    int           engine;
+    unsigned long cycles;
+    double        seconds;        //melhor tempo entre as repetições
+    uint64_t      displayHash;
+    byte          status;
+    double        baseline;       //MIPS do baseline (0: sem baseline)
+
+    //0 quando nenhuma instrução foi executada (a ROM parou logo na primeira)
+    double mips() const { return (cycles != 0 && seconds > 0) ? cycles / seconds / 1e6 : 0; }
+    double nsPerInstr() const { return (cycles != 0) ? seconds * 1e9 / cycles : 0; }
+};
+
+//instruções executadas por Op em uma ROM
+struct BenchMix {
+    std::string        rom;
+    unsigned long long total;
+    unsigned long long count[OP_COUNT];
+};
+
+/* Lê as opções da linha de comando */
+void parseOptions(int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+
+        if (strcmp(argv[i], "--roms") == 0 && hasValue) {
+            romDir = argv[++i];
+        } else if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            maxFrames = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--clock") == 0 && hasValue) {
+            clockHz = strtoul(argv[++i], NULL, 0);
+            if (clockHz == 0) {
+                printf("Invalid clock: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--keys") == 0 && hasValue) {
+            keysFile = argv[++i];
+        } else if (strcmp(argv[i], "--engine") == 0 && hasValue) {
+            i++;
+            if (strcmp(argv[i], "cached") == 0) {
+                engines.push_back(Chip8::ENGINE_CACHED);
+            } else if (strcmp(argv[i], "threaded") == 0) {
+                engines.push_back(Chip8::ENGINE_THREADED);
+            } else if (strcmp(argv[i], "jit") == 0) {
+                engines.push_back(Chip8::ENGINE_JIT);
+            } else {
+                printf("Unknown engine: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--repeat") == 0 && hasValue) {
+            repeat = strtoul(argv[++i], NULL, 0);
+            if (repeat < 1) {
+                repeat = 1;
+            }
+        } else if (strcmp(argv[i], "--idle-skip") == 0) {
+            idleSkip = true;
+        } else if (strcmp(argv[i], "--json") == 0 && hasValue) {
+            jsonName = argv[++i];
+        } else if (strcmp(argv[i], "--baseline") == 0 && hasValue) {
+            baselineName = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && hasValue) {
+            threshold = atof(argv[++i]);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    if (engines.empty()) {
+        engines.push_back(Chip8::ENGINE_CACHED);
+        engines.push_back(Chip8::ENGINE_THREADED);
+        engines.push_back(Chip8::ENGINE_JIT);
+    }
+}
+
+/* Nomes das ROMs do diretório (arquivos comuns, exceto ocultos), em ordem alfabética */
+bool listRoms(std::vector<std::string>& names) {
+    DIR* dir = opendir(romDir);
+    if (dir == NULL) {
+        printf("Couldn't open ROM directory: %s\n", romDir);
+        return false;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        std::string path = std::string(romDir) + "/" + entry->d_name;
+        struct stat info;
+        if (entry->d_name[0] != '.' && stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) {
+            names.push_back(entry->d_name);
+        }
+    }
+
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+    return true;
+}
+
+/* Roteiro padrão: cada tecla de 0 a F é segurada por 10 quadros, uma a cada 30 quadros */
+void defaultKeys() {
+    for (unsigned frame = 30; frame < maxFrames; frame += 30) {
+        byte key = (frame / 30) % 16;
+        script.add(frame, key, true);
+        script.add(frame + 10, key, false);
+    }
+}
+
+/* Prepara uma máquina nova com a ROM e a configuração do benchmark */
+bool setupMachine(Chip8& c, const std::string& rom, int engine) {
+    c.clockHz  = clockHz;
+    c.seed     = seed;
+    c.engine   = engine;
+    c.idleSkip = idleSkip;
+    c.trace    = NULL;
+    if (!c.loadROM((std::string(romDir) + "/" + rom).c_str())) {
+        return false;
+    }
+    script.setup(c);
+    return true;
+}
+
+/* Mede a ROM no motor: o melhor tempo de repeat execuções */
+bool measure(const std::string& rom, int engine, BenchResult& result) {
+    result.rom = rom;
+    result.engine = engine;
+    result.seconds = 0;
+    result.baseline = 0;
+
+    for (int r = 0; r < repeat; r++) {
+        Chip8* c = new Chip8;
+        if (!setupMachine(*c, rom, engine)) {
+            delete c;
+            return false;
+        }
+
+        KeyScript keys = script;
+        unsigned long frames;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result.cycles = runMachine(*c, keys, maxFrames, 0, frames);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (r == 0 || seconds < result.seconds) {
+            result.seconds = seconds;
+        }
+        result.displayHash = c->displayHash();
+        result.status = c->status;
+        delete c;
+    }
+
+    return true;
+}
+
+/*  Conta as instruções da ROM por Op, executando uma de cada vez no interpretador.
+ *  run(1) a cada instrução passa pelos mesmos ticks que run() do quadro inteiro.
+ */
+bool countOps(const std::string& rom, BenchMix& mix) {
+    mix.rom = rom;
+    mix.total = 0;
+    memset(mix.count, 0, sizeof(mix.count));
+
+    Chip8* c = new Chip8;
+    if (!setupMachine(*c, rom, Chip8::ENGINE_CACHED)) {
+        delete c;
+        return false;
+    }
+
+    KeyScript keys = script;
+    for (unsigned long frame = 0; frame < maxFrames && c->status == Chip8::RUNNING; frame++) {
+        keys.apply(*c, frame);
+        c->beep = false;
+        int cycles = c->cyclesToTick();
+        for (int i = 0; i < cycles && c->status == Chip8::RUNNING; i++) {
+            mix.count[opIndex(c->memory.fetchWord(c->PC & memMask))]++;
+            c->run(1);
+        }
+    }
+
+    for (int op = 0; op < OP_COUNT; op++) {
+        mix.total += mix.count[op];
+    }
+    delete c;
+    return true;
+}
+
+/* Pico de memória residente do processo, em KB */
+long peakRSS() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+    return usage.ru_maxrss; //Linux: KB
+}
+
+/* Chave de um par ROM/motor no baseline */
+std::string resultKey(const std::string& rom, const char* engine) {
+    return rom + "/" + engine;
+}
+
+/* Lê o MIPS de cada par ROM/motor de um JSON gravado com --json */
+bool loadBaseline(std::map<std::string, double>& baseline) {
+    FILE* file = fopen(baselineName, "r");
+    if (file == NULL) {
+        printf("Couldn't open baseline: %s\n", baselineName);
+        return false;
+    }
+
+    char line[4096];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char rom[256], engine[16];
+        double mips;
+        unsigned long frames;
+        unsigned clock;
+        if (sscanf(line, " \"frames\": %lu, \"clock\": %u", &frames, &clock) == 2 &&
+            (frames != maxFrames || clock != clockHz)) {
+            printf("warning: baseline ran %lu frames at clock %u\n", frames, clock);
+        }
+        if (sscanf(line, " {\"rom\": \"%255[^\"]\", \"engine\": \"%15[^\"]\", \"mips\": %lf", rom, engine, &mips) == 3) {
+            baseline[resultKey(rom, engine)] = mips;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+/* Escreve o nome entre aspas, com os caracteres especiais do JSON escapados */
+void writeString(FILE* out, const std::string& s) {
+    fputc('"', out);
+    for (size_t i = 0; i < s.size(); i++) {
+        unsigned char ch = s[i];
+        if (ch == '"' || ch == '\\') {
+            fprintf(out, "\\%c", ch);
+        } else if (ch < 0x20) {
+            fprintf(out, "\\u%.4x", ch);
+        } else {
+            fputc(ch, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/* Grava o resultado em JSON */
+bool writeJson(const std::vector<BenchResult>& results, const std::vector<BenchMix>& mixes, long rss) {
+    FILE* out = (strcmp(jsonName, "-") == 0) ? stdout : fopen(jsonName, "w");
+    if (out == NULL) {
+        printf("Couldn't create JSON file: %s\n", jsonName);
+        return false;
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"frames\": %lu, \"clock\": %u, \"seed\": %u, \"repeat\": %d, \"idle_skip\": %s,\n",
+            maxFrames, clockHz, seed, repeat, idleSkip ? "true" : "false");
+    fprintf(out, "  \"peak_rss_kb\": %ld,\n", rss);
+
+    fprintf(out, "  \"results\": [\n");
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        fprintf(out, "    {\"rom\": ");
+        writeString(out, r.rom);
+        fprintf(out, ", \"engine\": \"%s\", \"mips\": %.3f, \"ns_per_instr\": %.3f, \"instructions\": %lu, "
+                     "\"seconds\": %.6f, \"status\": \"%s\", \"display\": \"%.16llx\"}%s\n",
+                engineNames[r.engine], r.mips(), r.nsPerInstr(), r.cycles, r.seconds,
+                statusNames[r.status], (unsigned long long) r.displayHash, (i + 1 < results.size()) ? "," : "");
+    }
+    fprintf(out, "  ],\n");
+
+    fprintf(out, "  \"mix\": [\n");
+    for (size_t i = 0; i < mixes.size(); i++) {
+        const BenchMix& m = mixes[i];
+        fprintf(out, "    {\"rom\": ");
+        writeString(out, m.rom);
+        fprintf(out, ", \"instructions\": %llu, \"ops\": {", m.total);
+        for (int op = 0; op < OP_COUNT; op++) {
+            fprintf(out, "%s\"%s\": %llu", op ? ", " : "", opNames[op], m.count[op]);
+        }
+        fprintf(out, "}}%s\n", (i + 1 < mixes.size()) ? "," : "");
+    }
+    fprintf(out, "  ]\n");
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return true;
+}
+
+/* Imprime as Ops mais executadas da ROM, em porcentagem */
+void printMix(const BenchMix& m) {
+    bool shown[OP_COUNT] = {false};
+
+    printf("%-10s", m.rom.c_str());
+    for (int i = 0; i < 5; i++) {
+        //a Op mais executada entre as que ainda não foram impressas
+        int best = -1;
+        for (int op = 0; op < OP_COUNT; op++) {
+            if (!shown[op] && m.count[op] != 0 && (best < 0 || m.count[op] > m.count[best])) {
+                best = op;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = true;
+        printf("  %-8s %5.1f%%", opNames[best], 100.0 * m.count[best] / m.total);
+    }
+    printf("\n");
+}
+
+int main(int argc, char* argv[]) {
+    parseOptions(argc, argv);
+
+    if (keysFile != NULL) {
+        if (!script.load(keysFile)) {
+            exit(1);
+        }
+    } else {
+        defaultKeys();
+    }
+
+    std::map<std::string, double> baseline;
+    if (baselineName != NULL && !loadBaseline(baseline)) {
+        exit(1);
+    }
+
+    std::vector<std::string> roms;
+    if (!listRoms(roms)) {
+        exit(1);
+    }
+
+    //velocidade de cada ROM em cada motor
+    std::vector<BenchResult> results;
+    bool regressed = false;
+
+    printf("%-10s %-9s %12s %9s %9s %9s", "ROM", "engine", "instructions", "ms", "MIPS", "ns/instr");
+    printf(baselineName != NULL ? " %9s\n" : "\n", "baseline");
+    for (size_t i = 0; i < roms.size(); i++) {
+        uint64_t firstHash = 0;
+        for (size_t e = 0; e < engines.size(); e++) {
+            BenchResult r;
+            if (!measure(roms[i], engines[e], r)) {
+                continue; //a mensagem já foi impressa
+            }
+
+            double mips = r.mips();
+            printf("%-10s %-9s %12lu %9.2f", r.rom.c_str(), engineNames[r.engine], r.cycles, r.seconds * 1000);
+            if (r.cycles != 0) {
+                printf(" %9.2f %9.3f", mips, r.nsPerInstr());
+            } else {
+                printf(" %9s %9s", "-", "-");
+            }
+
+            std::map<std::string, double>::const_iterator base = baseline.find(resultKey(r.rom, engineNames[r.engine]));
+            if (base != baseline.end() && base->second > 0) {
+                r.baseline = base->second;
+                double change = 100 * (mips / r.baseline - 1);
+                bool slower = change < -threshold;
+                printf(" %+8.1f%%%s", change, slower ? "  REGRESSION" : "");
+                regressed |= slower;
+            }
+            printf("\n");
+
+            //os motores devem chegar à mesma tela
+            if (e == 0) {
+                firstHash = r.displayHash;
+            } else if (r.displayHash != firstHash) {
+                printf("warning: %s on %s ends with a different display than %s\n",
+                       r.rom.c_str(), engineNames[r.engine], engineNames[engines[0]]);
+            }
+            results.push_back(r);
+        }
+    }
+
+    //distribuição das instruções
+    std::vector<BenchMix> mixes;
+    printf("\ninstruction mix (top 5 ops)\n");
+    for (size_t i = 0; i < roms.size(); i++) {
+        BenchMix m;
+        if (countOps(roms[i], m)) {
+            printMix(m);
+            mixes.push_back(m);
+        }
+    }
+
+    long rss = peakRSS();
+    printf("\npeak RSS: %ld KB\n", rss);
+
+    if (jsonName != NULL && !writeJson(results, mixes, rss)) {
+        exit(1);
+    }
+
+    if (regressed) {
+        printf("regression: MIPS dropped more than %.1f%% against %s\n", threshold, baselineName);
+        return 1;
+    }
+    return 0;
+}
@@ -1 +1,4 @@
-g++ chip8.cpp -lsfml-graphics -lsfml-window -lsfml-system -lsfml-audio -o emulator
+g++ -pthread chip8.cpp -lsfml-graphics -lsfml-window -lsfml-system -lsfml-audio -o emulator
+g++ -O3 -pthread headless.cpp -o emulator-headless
+g++ -O2 c8trace.cpp -o c8trace
+g++ -O3 -pthread bench.cpp -o bench
@@ -0,0 +1,205 @@
+/****************************************************************************
+  Leitor do rastreamento binário do emulador Chip-8 (arquivos .c8t).
+
+  Os emuladores gravam o arquivo com a opção --trace-file (formato descrito em
+  trace.h). Esta ferramenta reconstrói os registradores de cada instrução e
+  imprime o rastreamento no mesmo formato das mensagens de debug, com filtros,
+  ou compara dois rastreamentos e mostra a primeira divergência.
+
+COMPILE:
+"./build.sh" (gera também o executável c8trace)
+
+EXECUTE:
+"./c8trace arquivo.c8t [opções]"
+"./c8trace --diff a.c8t b.c8t"
+
+OPÇÕES:
+--pc a-b           apenas instruções com PC entre a e b (hexadecimal; "a" sozinho: só a)
+--op padrão        apenas instruções que casam com o padrão hexadecimal ('?' casa com
+                   qualquer dígito), por exemplo "D???" ou "8??E"
+--display          imprime as linhas da tela alteradas por cada instrução
+--limit N          imprime no máximo N instruções
+--diff a b         compara dois rastreamentos; termina com 1 se eles divergem
+*****************************************************************************/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+
+//filtros
+word          pcLow   = 0x000;
+word          pcHigh  = 0xFFF;
+word          opMask  = 0x0000;   //dígitos do padrão que não são '?'
+word          opValue = 0x0000;
+bool          showDisplay = false;
+unsigned long limit = 0;          //0: sem limite
+
+/* Converte "a-b" ou "a" (hexadecimal) no intervalo de PC */
+bool parseRange(const char* text) {
+    char* end;
+    pcLow = strtoul(text, &end, 16);
+    pcHigh = pcLow;
+    if (*end == '-') {
+        pcHigh = strtoul(end + 1, &end, 16);
+    }
+    return *end == '\0' && pcLow <= pcHigh;
+}
+
+/* Converte o padrão de 4 dígitos hexadecimais (com '?') em máscara e valor */
+bool parsePattern(const char* text) {
+    if (strlen(text) != 4) {
+        return false;
+    }
+
+    opMask = opValue = 0;
+    for (int i = 0; i < 4; i++) {
+        char digit[2] = {text[i], '\0'};
+        opMask <<= 4;
+        opValue <<= 4;
+        if (text[i] == '?') {
+            continue;
+        }
+        if (!isxdigit((unsigned char) text[i])) {
+            return false;
+        }
+        opMask |= 0xF;
+        opValue |= strtoul(digit, NULL, 16);
+    }
+    return true;
+}
+
+/* Imprime uma instrução no formato de printHeader() */
+void printStep(const TraceStep& step) {
+    char text[32];
+    printRegisters(stdout, step.V, step.I, step.SP);
+    disassemble(step.instr, text, sizeof(text));
+    printf("$%.4x\t%s\n", step.pc, text);
+}
+
+/* Imprime as linhas da tela alteradas pela instrução, já com o novo conteúdo */
+void printRows(const TraceStep& step, const uint64_t* display) {
+    for (int i = 0; i < step.rows; i++) {
+        uint64_t line = display[step.row[i]];
+        printf("\t\t\t%.2d ", step.row[i]);
+        for (int j = 0; j < displayWidth; j++) {
+            putchar((line >> 63) ? '#' : '.');
+            line <<= 1;
+        }
+        putchar('\n');
+    }
+}
+
+/* Imprime o rastreamento, aplicando os filtros */
+int dump(const char* filename) {
+    TraceReader reader;
+    if (!reader.open(filename)) {
+        return 1;
+    }
+
+    if (showDisplay && !(reader.header.flags & TRACE_DISPLAY)) {
+        printf("Trace file has no display data (record it with --trace-display)\n");
+        return 1;
+    }
+
+    TraceStep step;
+    unsigned long printed = 0;
+    printHeader();
+    while (reader.next(step) && (limit == 0 || printed < limit)) {
+        if (step.pc < pcLow || step.pc > pcHigh || (step.instr & opMask) != opValue) {
+            continue;
+        }
+
+        printStep(step);
+        if (showDisplay) {
+            printRows(step, reader.display);
+        }
+        printed++;
+    }
+
+    return 0;
+}
+
+/* Compara dois rastreamentos instrução a instrução */
+int diff(const char* fileA, const char* fileB) {
+    TraceReader a, b;
+    if (!a.open(fileA) || !b.open(fileB)) {
+        return 1;
+    }
+
+    bool compareDisplay = (a.header.flags & TRACE_DISPLAY) && (b.header.flags & TRACE_DISPLAY);
+    TraceStep stepA, stepB;
+    for (;;) {
+        bool hasA = a.next(stepA);
+        bool hasB = b.next(stepB);
+
+        if (!hasA && !hasB) {
+            printf("Traces are identical\n");
+            return 0;
+        }
+        //as instruções são contadas a partir de 1; index começa em 0
+        if (hasA != hasB) {
+            //a primeira instrução que falta no mais curto: o seu index é o total dele
+            const TraceStep& extra = hasA ? stepA : stepB;
+            printf("Trace %s ends first, after %llu instructions\n", hasA ? fileB : fileA, extra.index);
+            return 1;
+        }
+
+        bool same = stepA.pc == stepB.pc && stepA.instr == stepB.instr && stepA.I == stepB.I &&
+                    stepA.SP == stepB.SP && memcmp(stepA.V, stepB.V, sizeof(stepA.V)) == 0;
+        if (same && compareDisplay) {
+            same = stepA.rows == stepB.rows &&
+                   memcmp(stepA.row, stepB.row, stepA.rows) == 0 &&
+                   memcmp(stepA.diff, stepB.diff, stepA.rows * sizeof(uint64_t)) == 0;
+        }
+
+        if (!same) {
+            printf("Traces diverge at instruction %llu\n", stepA.index + 1);
+            printHeader();
+            printStep(stepA);
+            printStep(stepB);
+            return 1;
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Trace file not specified!\n");
+        exit(1);
+    }
+
+    if (strcmp(argv[1], "--diff") == 0) {
+        if (argc != 4) {
+            printf("Usage: c8trace --diff a.c8t b.c8t\n");
+            exit(1);
+        }
+        return diff(argv[2], argv[3]);
+    }
+
+    for (int i = 2; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+
+        if (strcmp(argv[i], "--pc") == 0 && hasValue) {
+            if (!parseRange(argv[++i])) {
+                printf("Invalid PC range: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--op") == 0 && hasValue) {
+            if (!parsePattern(argv[++i])) {
+                printf("Invalid instruction pattern: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--display") == 0) {
+            showDisplay = true;
+        } else if (strcmp(argv[i], "--limit") == 0 && hasValue) {
+            limit = strtoul(argv[++i], NULL, 0);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+
+    return dump(argv[1]);
+}
@@ -22,7 +22,51 @@ COMPILE:
 "./build.sh"
 
 EXECUTE:
-"./emulator nome_da_rom"
+"./emulator nome_da_rom [opções]"
+"./emulator snapshot.c8s [opções]"  (continua a partir de um estado salvo)
+
+OPÇÕES:
+--engine cached    interpretador com cache de instruções decodificadas (padrão)
+--engine threaded  motor com goto computado; mais rápido, sem mensagens de debug
+--engine jit       traduz blocos da ROM para código x86-64; sem mensagens de debug
+--quiet            não imprime registradores e instruções (mensagens de debug)
+--clock N          instruções por segundo de tempo emulado (padrão: 360); os timers
+                   contam a 60hz desse tempo
+--max-speed        sem limite de velocidade: emula quantos quadros couberem em cada
+                   quadro da janela (os timers continuam no tempo emulado)
+--trace-file arq   grava o rastreamento binário em arq, lido pela ferramenta c8trace
+                   (substitui as mensagens de debug); desliga o rewind e o F9
+--trace-display    inclui as alterações da tela no rastreamento binário
+--state arq        arquivo usado por F5/F9 (padrão: savestate.c8s)
+--rewind N         guarda os últimos N segundos para o rewind (padrão: 300; 0 desliga)
+--rewind-memory N  memória máxima do rewind, em MB (padrão: 16)
+--latency ms       latência máxima do som, em milissegundos (padrão: 60)
+--mute             sem som (o gerador do tom roda sem saída)
+--record arq       grava as teclas da sessão em um movie (keyscript.h), que o emulador
+                   headless reproduz com --keys; desliga o rewind e o F9
+--pacing vsync     apresenta cada quadro no vsync, sem rasgar a imagem (padrão)
+--pacing late      sem vsync: apresenta cada quadro assim que a emulação o termina;
+                   menos latência, mas a imagem pode rasgar (tearing)
+--stats            ao sair, imprime a latência entre a leitura do teclado pela
+                   emulação e a apresentação, a latência entre os eventos de tecla e
+                   a apresentação e o jitter dos quadros (sempre impressos com
+                   --pacing late). Os eventos são medidos a partir de quando a janela
+                   os entrega: com vsync, o tempo que esperam enquanto a thread
+                   principal está bloqueada no vsync (até um quadro) não é contado
+
+THREADS:
+A emulação roda em uma thread própria, no seu próprio ritmo de 60 quadros por
+segundo (pacing.h): dorme até pouco antes do prazo de cada quadro, lê o
+teclado o mais tarde possível, executa o quadro e publica a tela em um buffer
+triplo (triplebuffer.h). A thread principal trata os eventos da janela, passa
+as teclas para a emulação em uma máscara de bits atômica e desenha o quadro
+mais recente; um vsync ou uma janela lenta não atrasam a emulação nem o som.
+
+TECLAS:
+F5                 salva o estado da máquina (snapshot.h)
+F9                 restaura o último estado salvo
+Backspace          (segurado) volta no tempo, um quadro por vez (rewind.h); o R,
+                   que seria a tecla natural, já é a tecla 9 do chip8
 *****************************************************************************/
 
 #include <SFML/Graphics.hpp>
@@ -31,563 +75,444 @@ EXECUTE:
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <atomic>
+#include <thread>
+#include "chip8.h"
+#include "rewind.h"
+#include "keyscript.h"
+#include "audio.h"
+#include "pacing.h"
+#include "triplebuffer.h"
 
 //definições
 #define WINDOW_SCALE   15 //para que a janela não seja muito pequena
-#define EMULATOR_SPEED 6  //controla a velocidade do emulador (chip-8 não possui clock definido)
 
-//tipos
-typedef unsigned char  byte;
-typedef unsigned short word;
-typedef signed char    sbyte;
-typedef signed short   sword;
-
-//memória principal
-const int memSize  = 0xFFF;   //4KB
-const int fontSize = 0x200;   //512B são utilizados para armazenar as fontes
-byte memory[memSize];         //armazena as fontes e a ROM
-
-//memória gráfica (tela)
-const int displayWidth  = 64;
-const int displayHeight = 32;
-byte display[displayWidth*displayHeight];
-
-//teclado
-byte key[17];
-
-//registradores
-byte V[0xF];                  //V0-VE: Propósito Geral; VF: Carry, Borrow e Detectção de Colisões
-word I, PC, SP;               //I: Registrador de índice; PC: Contador de Programa; SP: Stack Pointer (Ponteiro da Pilha)
-byte delayTimer, soundTimer;  //registradores de timer que contam a 60hz
+//máquina emulada
+Chip8       chip8;
+TraceBuffer traceBuffer; //instruções executadas, impressas ao fim de cada quadro
+TraceFile   traceFile;   //rastreamento binário (--trace-file)
+const char* traceName    = NULL;
+bool        traceDisplay = false;
+bool        maxSpeed     = false; //--max-speed
+const char* stateName    = "savestate.c8s"; //--state
+int         rewindSeconds = 300;  //--rewind
+int         rewindMemory  = 16;   //--rewind-memory, em MB
+const char* movieName     = NULL; //--record
+KeyRecorder movie;
+unsigned long frame = 0;          //quadros emulados desde o início
+unsigned    latency      = 60;    //--latency, em ms
+bool        mute         = false; //--mute
+bool        latePacing   = false; //--pacing late
+bool        showStats    = false; //--stats
+FrameStats  stats;                //medido pela thread principal
+
+//quadro publicado pela emulação para a thread principal
+const int keyHistory = 8; //eventos de tecla guardados em cada quadro
+
+struct Frame {
+    uint64_t              display[displayHeight];
+    unsigned long         version;  //muda sempre que a tela muda
+    PaceClock::time_point input;    //quando o teclado usado no quadro foi lido
+    unsigned long         keySeq;   //eventos de tecla aplicados até este quadro
+    PaceClock::time_point keyEvents[keyHistory]; //instante dos últimos eventos aplicados, por keySeq % keyHistory
+};
 
-//pilha de chamadas (call stack)
-const int stackLevels = 16;
-word stack[stackLevels];
+//comunicação entre as threads
+TripleBuffer<Frame>   frames;
+std::atomic<unsigned> keyMask(0);          //teclas do chip8 pressionadas, um bit por tecla
+std::atomic<PaceClock::rep> keyEvent(0);   //evento de tecla mais antigo ainda não lido pela emulação (0: nenhum)
+std::atomic<bool>     rewindHeld(false);   //Backspace segurado
+std::atomic<bool>     saveRequested(false); //F5
+std::atomic<bool>     loadRequested(false); //F9
+std::atomic<bool>     quit(false);         //a janela foi fechada
+std::atomic<bool>     stopped(false);      //a máquina parou (EXIT ou instrução inválida)
 
 //sfml
 sf::RenderWindow   window(sf::VideoMode(displayWidth*WINDOW_SCALE, displayHeight*WINDOW_SCALE), "Chip-8 Emulator", sf::Style::Close);
-sf::SoundBuffer    buffer;
-sf::Sound          sound;
-
-//conjunto de fontes (fontset)
-const byte fontset[80] = { 
-    0xF0, 0x90, 0x90, 0x90, 0xF0, //0
-    0x20, 0x60, 0x20, 0x20, 0x70, //1
-    0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
-    0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
-    0x90, 0x90, 0xF0, 0x10, 0x10, //4
-    0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
-    0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
-    0xF0, 0x10, 0x20, 0x40, 0x40, //7
-    0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
-    0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
-    0xF0, 0x90, 0xF0, 0x90, 0x90, //A
-    0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
-    0xF0, 0x80, 0x80, 0x80, 0xF0, //C
-    0xE0, 0x90, 0x90, 0x90, 0xE0, //D
-    0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
-    0xF0, 0x80, 0xF0, 0x80, 0x80  //F
-};
-
-/* Carrega a ROM na memória */
-void loadROM(const char* filename) {
-    //open file
-    FILE* file = fopen(filename, "rb");
-    if (file == NULL) {
-        printf("Couldn't open ROM: %s\n", filename);
-        exit(1);
+sf::Texture        texture;  //cópia da tela do chip8 na GPU, atualizada só quando ela muda
+sf::Sprite         sprite;
+sf::Uint8          pixels[displayWidth*displayHeight*4]; //tela convertida para RGBA
+
+/* Converte a tela do quadro para RGBA e envia para a textura, apenas se ela mudou */
+void updateTexture(const Frame& f) {
+    static const sf::Uint8 colors[2][4] = {
+        {0x00, 0x00, 0x00, 0xFF}, //apagado: preto
+        {0xFF, 0x00, 0x00, 0xFF}  //aceso: vermelho
+    };
+    static unsigned long shown = ~0UL; //versão da tela que está na textura
+
+    if (f.version == shown) {
+        return;
     }
 
-    //get file size
-    fseek(file, 0, SEEK_END);
-    long size = ftell(file);
-    rewind(file);
-    if (size > (memSize-fontSize)) {
-        printf("ROM too big for Chip8 Memory (more than 3.5KB)!\n");
-        exit(1);
+    sf::Uint8* out = pixels;
+    for (int i = 0; i < displayHeight; i++) {
+        uint64_t line = f.display[i];
+        for (int j = 0; j < displayWidth; j++) {
+            memcpy(out, colors[(line >> 63) & 1], 4);
+            line <<= 1;
+            out += 4;
+        }
     }
 
-    //read file into memory
-    fread(memory + fontSize, sizeof(byte), size, file);
-
-    //close
-    fclose(file);
+    texture.update(pixels);
+    shown = f.version;
 }
 
-/* Inicializa as estruturas (análogo a um "boot") */
-void startup() {
-    srand(time(NULL));  //seed para números aleatórios
+/* Desenha a tela; a textura e o sprite são criados uma única vez */
+void render(const Frame& f) {
+    updateTexture(f);
 
-    PC = 0x200;         //o sistema espera que a ROM esteja carregada em 0x200
-    I  = 0;             //inicializa o registrador de índice
-    SP = 0;             //inicializa o ponteiro da pilha
-    delayTimer = 0;     //inicializa o delay timer
-    soundTimer = 0;     //inicializa o timer de som
+    window.clear();
+    window.draw(sprite);
+}
 
-    //inicializa os registradores V0-VF
-    for (int i = 0; i < 0xF; i++) {
-        V[i] = 0;
+/* Lê as opções da linha de comando (após o nome da ROM) */
+void parseOptions(int argc, char* argv[]) {
+    for (int i = 2; i < argc; i++) {
+        if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "cached") == 0) {
+                chip8.engine = Chip8::ENGINE_CACHED;
+            } else if (strcmp(argv[i], "threaded") == 0) {
+                chip8.engine = Chip8::ENGINE_THREADED;
+                chip8.trace = NULL;
+            } else if (strcmp(argv[i], "jit") == 0) {
+                chip8.engine = Chip8::ENGINE_JIT;
+                chip8.trace = NULL;
+            } else {
+                printf("Unknown engine: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--quiet") == 0) {
+            chip8.trace = NULL;
+        } else if (strcmp(argv[i], "--clock") == 0 && i + 1 < argc) {
+            chip8.clockHz = strtoul(argv[++i], NULL, 0);
+            if (chip8.clockHz == 0) {
+                printf("Invalid clock: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--max-speed") == 0) {
+            maxSpeed = true;
+        } else if (strcmp(argv[i], "--trace-file") == 0 && i + 1 < argc) {
+            traceName = argv[++i];
+            chip8.trace = NULL;
+        } else if (strcmp(argv[i], "--trace-display") == 0) {
+            traceDisplay = true;
+        } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+            stateName = argv[++i];
+        } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+            rewindSeconds = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--rewind-memory") == 0 && i + 1 < argc) {
+            rewindMemory = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--latency") == 0 && i + 1 < argc) {
+            latency = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--mute") == 0) {
+            mute = true;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            movieName = argv[++i];
+        } else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "vsync") == 0) {
+                latePacing = false;
+            } else if (strcmp(argv[i], "late") == 0) {
+                latePacing = true;
+            } else {
+                printf("Unknown pacing: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            showStats = true;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
     }
+}
 
-    //limpa a pilha de chamadas
-    for (int i = 0; i < stackLevels; i++) {
-        stack[i] = 0;
+/* Saída de áudio: a thread de áudio do SFML lê as amostras geradas por Tone */
+class ToneStream : public sf::SoundStream {
+public:
+    explicit ToneStream(Tone& t) : tone(t), chunk(t.latencySamples() / 4 + 1) {
+        initialize(1, audioRate);
     }
 
-    //carrega o fontset na memória
-    for (int i = 0; i < 80; i++) { 
-        memory[i] = fontset[i];
-    }
+private:
+    Tone&                tone;
+    std::vector<int16_t> chunk;
 
-    //limpa a memória gráfica
-    for (int i = 0; i < displayWidth*displayHeight; i++) {
-        display[i] = 0;
+    virtual bool onGetData(Chunk& data) {
+        tone.read(&chunk[0], chunk.size());
+        data.samples = &chunk[0];
+        data.sampleCount = chunk.size();
+        return true; //o som nunca termina: sem tom, a saída é silêncio
     }
 
-    //limpa o teclado
-    for (int i = 0; i < 0xF; i++) {
-        key[i] = 0;
-    }
-}
+    virtual void onSeek(sf::Time) {}
+};
 
 /* Inicializa SFML */
 void sfmlStartup() {
-    window.setVerticalSyncEnabled(true);
-    window.setFramerateLimit(60); //garante 60hz
-
-    buffer.loadFromFile("sound/beep.wav"); //carrega um exemplo de som
-    sound.setBuffer(buffer);
-}
-
-/* Imprime uma mensagem de que a instrução não foi implementada e aborta a emulação */
-void notImplemented(word instr) {
-    printf("Instruction %.4x couldn't be interpreted! Aborting emulation...\n", instr);
-    exit(1);
-}
+    //o ritmo de 60hz é dado pela thread de emulação; o vsync só evita rasgar a imagem
+    if (!maxSpeed && !latePacing) {
+        window.setVerticalSyncEnabled(true);
+    }
 
-/* Imprime um cabeçalho com o nome dos registradores para fins de debug */
-void printHeader() {
-	printf("PC  \tINSTR\t\tV0   V1   V2   V3   V4   V5   V6   V7   V8   V9   VA   VB   VC   VD   VE   VF   I     SP\n");
+    texture.create(displayWidth, displayHeight);
+    sprite.setTexture(texture);
+    sprite.setScale(sf::Vector2f(WINDOW_SCALE, WINDOW_SCALE));
 }
 
-/* Imprime o valor dos registradores */
-void printState() {
-	printf("\t\t\t");
-    for (int i = 0; i <= 0xF; i++) {
-    	sbyte value = V[i];
-    	if (value >= 0) {
-    		printf("%.3d  ", value);
-    	} else {
-    		printf("%.3d ", value);
-    	}
+/* Estatísticas de latência e jitter (--stats, --pacing late) */
+void printStats() {
+    if (showStats || latePacing) {
+        stats.print(stdout);
     }
-    printf("$%.4x $%.4x\n", I, SP);
 }
 
-/* Exporta os dados da memória em um arquivo externo (memory.txt) para fins de debug */
-void printMemoryFile() {
-	FILE* file = fopen("memory.txt","w");
-
-    for (int i = 0; i < memSize; i++) {
-        fprintf(file, "[0x%.4x]\t0x%.4x\n", i, memory[i]);
+/* Tecla do chip8 correspondente à tecla do teclado, ou -1 */
+int chip8Key(sf::Keyboard::Key code) {
+    switch (code) {
+        case (sf::Keyboard::Q): return 0x0;
+        case (sf::Keyboard::A): return 0x1;
+        case (sf::Keyboard::Z): return 0x2;
+        case (sf::Keyboard::W): return 0x3;
+        case (sf::Keyboard::S): return 0x4;
+        case (sf::Keyboard::X): return 0x5;
+        case (sf::Keyboard::E): return 0x6;
+        case (sf::Keyboard::D): return 0x7;
+        case (sf::Keyboard::C): return 0x8;
+        case (sf::Keyboard::R): return 0x9;
+        case (sf::Keyboard::F): return 0xA;
+        case (sf::Keyboard::V): return 0xB;
+        case (sf::Keyboard::T): return 0xC;
+        case (sf::Keyboard::G): return 0xD;
+        case (sf::Keyboard::B): return 0xE;
+        case (sf::Keyboard::N): return 0xF;
     }
-
-    fclose(file);
+    return -1;
 }
 
-/* Limpa a memória gráfica (tela) */
-void clearDisplay() {
-    for (int i = 0; i < displayWidth*displayHeight; i++) { 
-        display[i] = 0;
-    }
+/* Registra a mudança da máscara de teclas, se a emulação já leu a anterior; chamado após mudá-la */
+void keyChanged() {
+    PaceClock::rep none = 0;
+    keyEvent.compare_exchange_strong(none, PaceClock::now().time_since_epoch().count(), std::memory_order_release);
 }
 
-/*  Desenha um sprite de uma determinado altura e largura 8 na tela a partir da coord (x,y).
- *  A localização do sprite é endereçada pelo registrador I. 
+/*  Copia a máscara de teclas da thread principal para o teclado do chip8.
+ *  Retorna o instante do evento de tecla mais antigo ainda não lido, ou 0 se não houve nenhum.
  */
-void draw(byte x, byte y, byte height) {
-    word pixel;
- 
-    x = x%64;
-    y = y%32;
-
-    V[0xF] = 0;
-    for (int yline = 0; yline < height; yline++) {
-        pixel = memory[I + yline];
-        for (int xline = 0; xline < 8; xline++) {
-            if ((pixel & (0x80 >> xline)) != 0) {
-                if (display[(x + xline + ((y + yline) * 64))] == 1) {
-                    V[0xF] = 1;                                 
-                }
-                display[x + xline + ((y + yline) * 64)] ^= 1;
-            }
-        }
+PaceClock::rep applyKeys() {
+    //o evento antes da máscara: um evento lido aqui sempre tem a sua tecla na máscara
+    PaceClock::rep event = keyEvent.exchange(0, std::memory_order_acquire);
+    unsigned mask = keyMask.load(std::memory_order_acquire);
+    for (int i = 0; i <= 0xF; i++) {
+        chip8.key[i] = (mask >> i) & 1;
     }
+    return event;
 }
 
-/* Converte o valor de Vx para BCD e grava na memória a partir do endereço em I */
-void storeBCD(unsigned char& Vx) {
-    memory[I]     = Vx / 100;
-    memory[I + 1] = (Vx / 10) % 10;
-    memory[I + 2] = (Vx % 100) % 10;
-}
+/*  Thread de emulação: a cada quadro, lê o teclado, executa, gera o som e publica a
+ *  tela. Termina quando a janela é fechada (quit) ou quando a máquina para (stopped).
+ */
+void emulate(Tone& tone, Rewind* history) {
+    FramePacer pacer(TIMER_HZ);
+    unsigned long version = 0;
+    unsigned long keySeq = 0;
+    PaceClock::time_point keyEvents[keyHistory];
+
+    while (!quit.load(std::memory_order_relaxed)) {
+        //esperando uma tecla (LD Vx, K), nem --max-speed tem o que adiantar: volta a 60hz
+        if (!maxSpeed || chip8.waiting) {
+            pacer.wait();
+        }
 
-/* Espera por uma tecla ser pressionada */
-void waitKey(byte& Vx) {
-    bool pressed = false;
+        //teclado e comandos, lidos o mais perto possível da execução do quadro
+        PaceClock::time_point input = pacer.inputSampled();
+        if (saveRequested.exchange(false)) {
+            chip8.saveState(stateName);
+        }
+        //o movie e o rastreamento não voltam no tempo: com eles, F9 é ignorado
+        if (loadRequested.exchange(false) && !movie.recording() && chip8.traceFile == NULL) {
+            chip8.loadState(stateName);
+        }
 
-    for (int i = 0; i<0xF; i++) { 
-        if (key[i]) { 
-            Vx = i;
-            pressed = true;
+        //com Backspace segurado, volta um quadro em vez de executar; o teclado
+        //continua sendo o de agora, não o do quadro restaurado
+        bool rewinding = history != NULL && rewindHeld.load(std::memory_order_relaxed);
+        if (rewinding) {
+            history->rewind(chip8);
+        }
+        PaceClock::rep event = applyKeys();
+
+        //executa as instruções de um quadro (1/60s de tempo emulado); em velocidade
+        //máxima, de tantos quadros quantos couberem em 1/60s de tempo real
+        PaceClock::time_point start = PaceClock::now();
+        if (rewinding) {
+            tone.tick(false);
+        } else {
+            do {
+                movie.record(chip8, frame++);
+                chip8.runFrame();
+                tone.tick(chip8.beep); //1/60s de tom ou de silêncio
+                if (chip8.trace != NULL) {
+                    chip8.trace->flush(stdout);
+                }
+                if (history != NULL) {
+                    history->push(chip8);
+                }
+                //esperando uma tecla (LD Vx, K), os próximos quadros só contariam os timers:
+                //o restante do quadro fica livre até o próximo evento
+            } while (maxSpeed && chip8.status == Chip8::RUNNING && !chip8.waiting &&
+                     PaceClock::now() - start < std::chrono::milliseconds(1000 / 60));
         }
-    }
 
-    if (!pressed) {
-        PC -= 2;
+        //publica a tela
+        if (chip8.dirty) {
+            version++;
+            chip8.dirty = false;
+        }
+        Frame& f = frames.writeBuffer();
+        memcpy(f.display, chip8.display, sizeof(f.display));
+        f.version = version;
+        f.input = input;
+        if (event != 0) {
+            keySeq++;
+            keyEvents[keySeq % keyHistory] = PaceClock::time_point(PaceClock::duration(event));
+        }
+        f.keySeq = keySeq;
+        memcpy(f.keyEvents, keyEvents, sizeof(f.keyEvents));
+        frames.publish();
+        pacer.finished();
+
+        if (chip8.status != Chip8::RUNNING) {
+            stopped.store(true, std::memory_order_release);
+            return;
+        }
     }
 }
 
-/* Lê os registradores da memória */
-void readRegistersFromMem(byte x) {
-    for (int i = 0; i <= x; ++i) {
-        V[i] = memory[I + i];
+int main(int argc, char* argv[]) {
+	//verificar se ROM foi passada como parâmetro
+    if (argc < 2) {
+        printf("ROM not specified!\n");
+        exit(1);
     }
 
-    I += x + 1;
-}
-
-/* Escreve os registradores na memória */
-void writeRegistersToMem(byte x) {
-    for (int i = 0; i <= x; ++i) {
-        memory[I + i] = V[i];
-    }
+    //inicializar estruturas
+    chip8.startup();
+    chip8.seed = time(NULL);  //seed para números aleatórios
+    chip8.trace = &traceBuffer; //exibe registradores e instruções a cada ciclo
+    parseOptions(argc, argv);
 
-    I += x + 1;
-}
+    //inicializa o SFML
+    sfmlStartup();
 
-/* Emula um ciclo do chip8 (busca, decodifica e executa uma instrução) */
-void emulateCycle() {
-	//antes de mais nada, vamos exibir informações para debug
-	printState();
-	printf("$%.4x\t", PC);
-
-    //busca de instrução
-    word instr = ((memory[PC] << 8) | memory[PC + 1]);
-
-    //atualiza PC
-    PC += 2;
-
-    //extrai os bits da instrução
-    byte p   = ((instr & 0xF000) >> 12);
-    byte x   = ((instr & 0x0F00) >> 8);
-    byte y   = ((instr & 0x00F0) >> 4);
-    byte kk  = (instr & 0x00FF);
-    word nnn = (instr & 0x0FFF);
-    byte n   = (instr & 0x000F);
-
-    //aloca-se uma variável temporária para executar as operações
-    word tmp;
-
-    //executa a instrução
-    switch (p) {
-        case 0x0:
-            switch (kk) {
-                case 0xE0: //CLS
-                	printf("CLS");
-                	clearDisplay();
-                    break;
-                case 0xEE: //RET
-                	printf("RET");
-                	SP--;
-                    PC = stack[SP];
-                    break;
-                case 0xFD: //EXIT
-                	printf("EXIT\n");
-                	printMemoryFile();
-                	exit(0);
-                	break;
-                default:  //SYS addr
-                	printf("SYS 0x%x (ignoring)", nnn);
-                    break;
-            }
-            break;
-        case 0x1: //JP addr
-            printf("JP 0x%x", nnn);
-            PC = nnn;
-            break;
-        case 0x2: //CALL addr
-            printf("CALL 0x%x", nnn);
-            stack[SP] = PC;
-            SP++;
-            PC = nnn;
-            break;
-        case 0x3: //SE Vx, byte
-            printf("SE V%x, #%d", x, (sbyte) kk);
-            if (V[x] == kk) {
-                PC += 2;
-            }
-            break;
-        case 0x4: //SNE Vx, byte
-            printf("SNE V%x, #%d", x, (sbyte) kk);
-            if (V[x] != kk) {
-                PC += 2;
-            }
-            break;
-        case 0x5: //SE Vx, Vy
-            printf("SE V%x, V%x", x, y);
-            if (V[x] == V[y]) {
-                PC += 2;
-            }
-            break;
-        case 0x6: //LD Vx, byte
-        	printf("LD V%x, #%d", x, (sbyte) kk);
-            V[x] = kk;
-            break;
-        case 0x7: //ADD Vx, byte
-            printf("ADD V%x, #%d", x, kk);
-            V[x] += kk;
-            break;
-        case 0x8:
-            switch (n) {
-                case 0x0: //LD  Vx, Vy
-                    printf("LD V%x, V%x", x, y);
-                    V[x] = V[y];
-                    break;
-                case 0x1: //OR  Vx, Vy
-                    printf("OR V%x, V%x", x, y);
-                    V[x] |= V[y];
-                    break;
-                case 0x2: //AND Vx, Vy
-                    printf("AND V%x, V%x", x, y);
-                    V[x] &= V[y];
-                    break;
-                case 0x3: //XOR Vx, Vy
-                    printf("XOR V%x, V%x", x, y);
-                    V[x] ^= V[y];
-                    break;
-                case 0x4: //ADD Vx, Vy
-                    printf("ADD V%x, V%x", x, y);
-                    tmp = V[x] + V[y];
-                    V[0xF] = (tmp >> 8);
-                    V[x] = tmp;
-                    break;
-                case 0x5: //SUB Vx, Vy
-                	printf("SUB V%x, V%x", x, y);
-                	tmp = V[x] - V[y];
-                    V[0xF] = !(tmp >> 8);
-                    V[x] = tmp;
-                    break;
-                case 0x6: //SHR Vx {, Vy}
-                    printf("SHR V%x {, V%x}", x, y);
-                    V[0xF] = V[y] & 1;
-                    V[x] = V[y] << 1;
-                    break;
-                case 0x7: //SUBN Vx, Vy
-                    printf("SUBN V%x, V%x", x, y);
-                    tmp = V[y] - V[x];
-                    V[0xF] = !(tmp >> 8);
-                    V[x] = tmp;
-                    break;
-                case 0xE: //SHL Vx {, Vy}
-                    printf("SHL V%x {, V%x}", x, y);
-                    V[0xF] = V[y] >> 7;
-                    V[x] = V[y] >> 1;
-                    break;
-                default:
-                    printf("Invalid opcode!\n");
-                    exit(1);
-            }
-            break;
-        case 0x9: //SNE Vx, Vy
-            printf("SNE V%x, V%x", x, y);
-            if (V[x] != V[y]) {
-                PC += 2;
-            }
-            break;
-        case 0xA: //LD I, addr
-            printf("LD I, 0x%x", nnn);
-            I = nnn;
-            break;
-        case 0xB: //JP V0, addr
-            printf("JP V0, 0x%x", nnn);
-            PC = V[0] + nnn;
-            break;
-        case 0xC: //RND Vx, byte
-            printf("RND V0, 0x%x", (sbyte) kk);
-            V[x] = ( rand()%0xF & kk );
-            break;
-        case 0xD: //DRW Vx, Vy, nibble
-            printf("DRW V%x, V%x, 0x%x", x, y, n);
-            draw(V[x],V[y],n);
-            break;
-        case 0xE:
-            switch (kk) {
-                case 0x9E: //SKP Vx
-                    printf("SKP V%x", x);
-                    if (key[V[x]]) {
-                        PC += 2;
-                    }
-                    break;
-                case 0xA1: //SKNP Vx
-                    printf("SKNP V%x", x);
-                    if (!key[V[x]]) {
-                        PC += 2;
-                    }
-                    break;
-                default:
-                    printf("Invalid opcode!\n");
-                    exit(1);
-            }
-            break;
-        case 0xF:
-            switch (kk) {
-                case 0x07: //LD Vx, DT
-                    printf("LD V%x, DT", x);
-                    V[x] = delayTimer;
-                    break;
-                case 0x0A: //LD Vx, K
-                    printf("LD V%x, K", x);
-                    waitKey(V[x]);
-                    break;
-                case 0x15: //LD DT, Vx
-                    printf("LD DT, V%x", x);
-                    delayTimer = V[x];
-                    break;
-                case 0x18: //LD ST, Vx
-                    printf("LD ST, V%x", x);
-                    soundTimer = V[x]; 
-                    break;
-                case 0x1E: //ADD I, Vx
-                    printf("ADD I, V%x", x);
-                    I += V[x];
-                    break;
-                case 0x29: //LD F, Vx
-                    printf("LD F, V%x", x);
-                    I = V[x]*0x5;
-                    break;
-                case 0x33: //LD B, Vx
-                    printf("LD B, V%x", x);
-                    storeBCD(V[x]);
-                    break;
-                case 0x55: //LD [I], Vx
-                    printf("LD [I], V%x", x);
-                    writeRegistersToMem(x);
-                    break;
-                case 0x65: //LD Vx, [I]
-                    printf("LD V%x. [I]", x);
-                    readRegistersFromMem(x); 
-                    break;
-                default:
-                    printf("Invalid opcode!\n");
-                    exit(1);
-            }
-            break;
+    //carrega a ROM na memória (ou restaura o snapshot)
+    if (!loadProgram(chip8, argv[1])) {
+        exit(1);
     }
 
-    //atualiza os timers
-    if (delayTimer > 0)
-        delayTimer--;
-    if (soundTimer > 0) {
-        sound.play(); //reproduz o beep
-        soundTimer--;
+    if (traceName != NULL) {
+        if (!traceFile.open(traceName, chip8, traceDisplay)) {
+            exit(1);
+        }
+        chip8.traceFile = &traceFile;
     }
 
-    printf("\n");
-}
+    if (chip8.trace != NULL) {
+        printHeader(); //exibi um header dos registradores
+    }
 
-int main(int argc, char* argv[]) {
-	//verificar se ROM foi passada como parâmetro
-    if (argc < 2) {
-        printf("ROM not specified!\n");
+    if (movieName != NULL && !movie.open(movieName, chip8)) {
         exit(1);
     }
 
-    //inicializar estruturas
-    startup();
-
-    //inicializa o SFML
-    sfmlStartup();
+    //som: sem --mute, o tom vai para a placa de som; com --mute, Tone é o backend nulo
+    Tone tone(latency);
+    ToneStream* stream = NULL;
+    if (!mute) {
+        stream = new ToneStream(tone);
+        tone.setStreaming(true);
+        stream->play();
+    }
 
-    //carrega a ROM na memória
-    loadROM(argv[1]);
+    //histórico para o rewind (desligado com --trace-file e --record: o rastreamento e
+    //o movie não voltam no tempo)
+    Rewind* history = NULL;
+    if (rewindSeconds > 0 && traceName == NULL && movieName == NULL) {
+        history = new Rewind(rewindSeconds * TIMER_HZ, (size_t) rewindMemory << 20);
+        history->push(chip8);
+    }
 
-    //cria uma imagem para atualizar a tela
-    sf::Image image;
-    image.create(displayWidth, displayHeight, sf::Color::Black);
+    std::thread emulation(emulate, std::ref(tone), history);
+    unsigned long keyShown = 0; //eventos de tecla já apresentados
 
-    printHeader(); //exibi um header dos registradores
     while (window.isOpen()) {
-        //verifica por teclas pressionadas, atualizando o vetor de teclado ("keys")
+        //eventos da janela: as teclas do chip8 vão para a máscara lida pela emulação
         sf::Event event;
         while (window.pollEvent(event)) {
             if (event.type == sf::Event::Closed) {
                 window.close();
             } else if (event.type == sf::Event::KeyPressed) {
-                switch (event.key.code) {
-                    case (sf::Keyboard::Q): key[0x0] = 1; break;
-                    case (sf::Keyboard::A): key[0x1] = 1; break;
-                    case (sf::Keyboard::Z): key[0x2] = 1; break;
-                    case (sf::Keyboard::W): key[0x3] = 1; break; 
-                    case (sf::Keyboard::S): key[0x4] = 1; break; 
-                    case (sf::Keyboard::X): key[0x5] = 1; break; 
-                    case (sf::Keyboard::E): key[0x6] = 1; break; 
-                    case (sf::Keyboard::D): key[0x7] = 1; break; 
-                    case (sf::Keyboard::C): key[0x8] = 1; break; 
-                    case (sf::Keyboard::R): key[0x9] = 1; break; 
-                    case (sf::Keyboard::F): key[0xA] = 1; break;
-                    case (sf::Keyboard::V): key[0xB] = 1; break; 
-                    case (sf::Keyboard::T): key[0xC] = 1; break; 
-                    case (sf::Keyboard::G): key[0xD] = 1; break; 
-                    case (sf::Keyboard::B): key[0xE] = 1; break; 
-                    case (sf::Keyboard::N): key[0xF] = 1;
+                int k = chip8Key(event.key.code);
+                if (k >= 0) {
+                    keyMask.fetch_or(1u << k, std::memory_order_release);
+                    keyChanged();
+                } else if (event.key.code == sf::Keyboard::F5) {
+                    saveRequested.store(true);
+                } else if (event.key.code == sf::Keyboard::F9) {
+                    loadRequested.store(true);
                 }
             } else if (event.type == sf::Event::KeyReleased) {
-                switch (event.key.code) {
-                    case (sf::Keyboard::Q): key[0x0] = 0; break;
-                    case (sf::Keyboard::A): key[0x1] = 0; break;
-                    case (sf::Keyboard::Z): key[0x2] = 0; break;
-                    case (sf::Keyboard::W): key[0x3] = 0; break; 
-                    case (sf::Keyboard::S): key[0x4] = 0; break; 
-                    case (sf::Keyboard::X): key[0x5] = 0; break; 
-                    case (sf::Keyboard::E): key[0x6] = 0; break; 
-                    case (sf::Keyboard::D): key[0x7] = 0; break; 
-                    case (sf::Keyboard::C): key[0x8] = 0; break; 
-                    case (sf::Keyboard::R): key[0x9] = 0; break; 
-                    case (sf::Keyboard::F): key[0xA] = 0; break;
-                    case (sf::Keyboard::V): key[0xB] = 0; break; 
-                    case (sf::Keyboard::T): key[0xC] = 0; break; 
-                    case (sf::Keyboard::G): key[0xD] = 0; break; 
-                    case (sf::Keyboard::B): key[0xE] = 0; break; 
-                    case (sf::Keyboard::N): key[0xF] = 0;
+                int k = chip8Key(event.key.code);
+                if (k >= 0) {
+                    keyMask.fetch_and(~(1u << k), std::memory_order_release);
+                    keyChanged();
                 }
-            } 
+            }
         }
+        rewindHeld.store(history != NULL && window.hasFocus() && sf::Keyboard::isKeyPressed(sf::Keyboard::BackSpace),
+                         std::memory_order_relaxed);
 
-        //executa as instruções
-        for (int i = 0; i < EMULATOR_SPEED; i++) {
-            emulateCycle();
+        if (stopped.load(std::memory_order_acquire)) {
+            break;
         }
 
-        //desenha na tela
-        window.clear();
-            for (int i = 0; i < displayHeight; i++) {
-                for (int j = 0; j < displayWidth; j++) {
-                    if (display[j + i*displayWidth] == 1) {
-                    	image.setPixel(j, i, sf::Color::Red);
-                    } else {
-                    	image.setPixel(j, i, sf::Color::Black);
-                    }
+        //desenha o quadro mais recente; sem quadro novo, espera um pouco e volta aos eventos
+        if (frames.update()) {
+            const Frame& f = frames.readBuffer();
+            render(f);
+            window.display();
+            stats.presented(f.input);
+            //quadros descartados pelo buffer triplo: as suas teclas aparecem neste
+            for (; keyShown != f.keySeq; keyShown++) {
+                if (f.keySeq - keyShown <= keyHistory) {
+                    stats.keyPresented(f.keyEvents[(keyShown + 1) % keyHistory]);
                 }
             }
-            sf::Texture texture;
-		    texture.loadFromImage(image);
-		    sf::Sprite sprite;
-		    sprite.setTexture(texture);
-		    sprite.setScale(sf::Vector2f(WINDOW_SCALE, WINDOW_SCALE));
-            window.draw(sprite);
-        window.display();
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    quit.store(true);
+    emulation.join();
+
+    traceFile.close(chip8);
+    movie.close(chip8, frame);
+    printStats();
+    delete history;
+    if (stream != NULL) {
+        stream->stop();
+        delete stream;
     }
 
+    if (chip8.status == Chip8::EXITED) {
+        chip8.printMemoryFile();
+    } else if (chip8.status == Chip8::CRASHED) {
+        printf("Instruction %.4x couldn't be interpreted! Aborting emulation...\n", chip8.badInstr);
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,1421 @@
+/****************************************************************************
+  Núcleo do emulador Chip-8.
+
+  Todo o estado da máquina (memória, registradores, pilha, tela, teclado e
+  timers) fica dentro da classe Chip8, de modo que um mesmo processo pode
+  hospedar quantas máquinas quiser. O frontend (chip8.cpp) apenas cria uma
+  instância, alimenta o teclado e desenha a tela.
+
+  USO:
+      Chip8 chip8;
+      chip8.startup();
+      chip8.loadROM("roms/PONG");
+      while (chip8.status == Chip8::RUNNING) {
+          chip8.runFrame();   //ou chip8.step() para uma única instrução
+      }
+
+  Copiar a máquina (Chip8 b = a) é barato: a memória é dividida em páginas
+  compartilhadas entre as cópias e duplicadas apenas na primeira escrita.
+
+  O estado pode ser salvo e restaurado a qualquer momento entre instruções com
+  snapshot()/restore() ou saveState()/loadState() (snapshot.h).
+
+  Laços ociosos (por exemplo LD Vx, DT / SE Vx, 0 / JP, esperando o delay timer)
+  são detectados pelo escalonador e pulados sem executar (idleSkip); o resultado
+  é idêntico ao da execução instrução por instrução.
+
+  LD Vx, K sem tecla pressionada não é repetida a cada ciclo: a máquina entra no
+  estado de espera (waiting) e o resto do tempo de run() passa sem executar nada,
+  com os timers contando. A instrução é tentada de novo na próxima chamada, depois
+  que o frontend atualizar o teclado.
+*****************************************************************************/
+
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <atomic>
+
+//definições
+#define EMULATOR_CLOCK 360 //instruções por segundo de tempo emulado (chip-8 não possui clock definido)
+#define TIMER_HZ       60  //frequência dos timers (e de um quadro, 1/60s)
+
+//tipos
+typedef unsigned char  byte;
+typedef unsigned short word;
+typedef signed char    sbyte;
+typedef signed short   sword;
+
+//memória principal
+const int memSize  = 0x1000;  //4KB
+const int memMask  = memSize - 1;
+const int fontSize = 0x200;   //512B são utilizados para armazenar as fontes
+const int pageSize  = 0x100;  //a memória é dividida em páginas de 256B (copy-on-write)
+const int pageMask  = pageSize - 1;
+const int pageShift = 8;
+const int pageCount = memSize / pageSize;
+
+//memória gráfica (tela)
+const int displayWidth  = 64;
+const int displayHeight = 32;
+
+//pilha de chamadas (call stack)
+const int stackLevels = 16;
+
+//conjunto de fontes (fontset)
+const byte fontset[80] = {
+    0xF0, 0x90, 0x90, 0x90, 0xF0, //0
+    0x20, 0x60, 0x20, 0x20, 0x70, //1
+    0xF0, 0x10, 0xF0, 0x80, 0xF0, //2
+    0xF0, 0x10, 0xF0, 0x10, 0xF0, //3
+    0x90, 0x90, 0xF0, 0x10, 0x10, //4
+    0xF0, 0x80, 0xF0, 0x10, 0xF0, //5
+    0xF0, 0x80, 0xF0, 0x90, 0xF0, //6
+    0xF0, 0x10, 0x20, 0x40, 0x40, //7
+    0xF0, 0x90, 0xF0, 0x90, 0xF0, //8
+    0xF0, 0x90, 0xF0, 0x10, 0xF0, //9
+    0xF0, 0x90, 0xF0, 0x90, 0x90, //A
+    0xE0, 0x90, 0xE0, 0x90, 0xE0, //B
+    0xF0, 0x80, 0x80, 0x80, 0xF0, //C
+    0xE0, 0x90, 0x90, 0x90, 0xE0, //D
+    0xF0, 0x80, 0xF0, 0x80, 0xF0, //E
+    0xF0, 0x80, 0xF0, 0x80, 0x80  //F
+};
+
+/* Imprime um cabeçalho com o nome dos registradores para fins de debug */
+inline void printHeader() {
+    printf("PC  \tINSTR\t\tV0   V1   V2   V3   V4   V5   V6   V7   V8   V9   VA   VB   VC   VD   VE   VF   I     SP\n");
+}
+
+/* Imprime o valor dos registradores */
+inline void printRegisters(FILE* out, const byte* V, word I, word SP) {
+    fprintf(out, "\t\t\t");
+    for (int i = 0; i <= 0xF; i++) {
+        sbyte value = V[i];
+        if (value >= 0) {
+            fprintf(out, "%.3d  ", value);
+        } else {
+            fprintf(out, "%.3d ", value);
+        }
+    }
+    fprintf(out, "$%.4x $%.4x\n", I, SP);
+}
+
+/*  Gerador de números aleatórios da instrução RND (mulberry32): o estado tem 32 bits,
+ *  qualquer semente (inclusive 0) serve, e cada máquina tem o seu, sem trava global
+ *  como o rand() da libc. Para trocar o gerador basta trocar esta função.
+ */
+inline uint32_t nextRandom(unsigned& state) {
+    uint32_t z = (state += 0x6D2B79F5u);
+    z = (z ^ (z >> 15)) * (z | 1u);
+    z ^= z + (z ^ (z >> 7)) * (z | 61u);
+    return z ^ (z >> 14);
+}
+
+inline void disassemble(word instr, char* out, size_t size);
+inline byte opIndex(word instr);
+
+class Chip8;
+class TraceBuffer;
+class TraceFile;
+class Profiler;
+struct Instr;
+
+//executa uma instrução decodificada
+typedef void (*Handler)(Chip8& c, const Instr& in);
+
+//identificador de cada instrução, compartilhado pelos motores de execução
+enum Op {
+    OP_CLS, OP_RET, OP_EXIT, OP_SYS, OP_JP, OP_CALL, OP_SE_BYTE, OP_SNE_BYTE, OP_SE_REG, OP_LD_BYTE, OP_ADD_BYTE,
+    OP_LD_REG, OP_OR, OP_AND, OP_XOR, OP_ADD_REG, OP_SUB, OP_SHR, OP_SUBN, OP_SHL, OP_SNE_REG, OP_LD_I, OP_JP_V0,
+    OP_RND, OP_DRW, OP_SKP, OP_SKNP, OP_LD_VX_DT, OP_LD_VX_K, OP_LD_DT, OP_LD_ST, OP_ADD_I, OP_LD_F, OP_LD_B,
+    OP_LD_I_VX, OP_LD_VX_I, OP_INVALID,
+    OP_COUNT
+};
+
+//nome de cada Op, na mesma ordem do enum (relatórios de benchmark e de profiling)
+const char* const opNames[OP_COUNT] = {
+    "CLS", "RET", "EXIT", "SYS", "JP", "CALL", "SE_BYTE", "SNE_BYTE", "SE_REG", "LD_BYTE", "ADD_BYTE",
+    "LD_REG", "OR", "AND", "XOR", "ADD_REG", "SUB", "SHR", "SUBN", "SHL", "SNE_REG", "LD_I", "JP_V0",
+    "RND", "DRW", "SKP", "SKNP", "LD_VX_DT", "LD_VX_K", "LD_DT", "LD_ST", "ADD_I", "LD_F", "LD_B",
+    "LD_I_VX", "LD_VX_I", "INVALID"
+};
+
+/* Instrução decodificada: handler e operandos já extraídos */
+struct Instr {
+    Handler exec;
+    word    instr;                //instrução original (2 bytes)
+    word    nnn;
+    byte    x, y, kk, n;
+};
+
+class Jit;
+
+/*  Referência para o JIT de uma instância. Cópias da máquina não herdam o código
+ *  compilado: começam vazias e recompilam sob demanda.
+ */
+struct JitRef {
+    Jit* ptr;
+
+    JitRef() : ptr(NULL) {}
+    JitRef(const JitRef&) : ptr(NULL) {}
+    JitRef& operator=(const JitRef&) { reset(); return *this; }
+    ~JitRef();
+
+    void reset();
+};
+
+inline void jitInvalidate(Jit* jit, word addr);
+
+/* Página da memória: os bytes e a instrução já decodificada que começa em cada um */
+struct MemPage {
+    std::atomic<int> refs;        //memórias que usam a página
+    byte  data[pageSize];
+    Instr code[pageSize];         //a última instrução atravessa a página e não é guardada
+};
+
+/*  Memória principal, dividida em páginas com contagem de referências.
+ *  Copiar a memória (e portanto a máquina) copia apenas os ponteiros das páginas;
+ *  uma página compartilhada só é duplicada na primeira escrita (copy-on-write).
+ *  Páginas compartilhadas nunca são alteradas, por isso as cópias podem rodar
+ *  em threads diferentes. As páginas zeradas de todas as máquinas são uma só.
+ */
+class Memory {
+public:
+    Memory();
+    Memory(const Memory& other);
+    Memory& operator=(const Memory& other);
+    ~Memory();
+
+    byte operator[](int addr) const { return page[addr >> pageShift]->data[addr & pageMask]; }
+    bool operator==(const Memory& other) const;
+
+    //bytes da página que contém addr (válidos até a próxima escrita na memória)
+    const byte* pageData(int addr) const { return page[addr >> pageShift]->data; }
+
+    //instrução (2 bytes) que começa em addr
+    word fetchWord(int addr) const {
+        const byte* data = page[addr >> pageShift]->data;
+        int offset = addr & pageMask;
+        if (offset == pageMask) {
+            return (data[offset] << 8) | (*this)[(addr + 1) & memMask];
+        }
+        return (data[offset] << 8) | data[offset + 1];
+    }
+
+    //instrução decodificada em addr (addr & pageMask deve ser menor que pageMask)
+    const Instr& code(int addr) const { return page[addr >> pageShift]->code[addr & pageMask]; }
+
+    void write(int addr, byte value);
+    void load(int addr, const byte* data, int size);
+    void copy(int addr, byte* out, int size) const;
+    void clear();
+    int  sharedPages() const;
+
+    static const Memory& boot();
+
+private:
+    MemPage* page[pageCount];
+
+    MemPage* own(int n);
+    static MemPage* newPage(const MemPage* from);
+    static MemPage* zeroPage();
+    static void release(MemPage* p);
+    static void decode(MemPage* p, int offset);
+};
+
+/*  Uma máquina Chip-8 completa.
+ *  Os campos mais acessados (registradores, pilha e timers) vêm primeiro, cabendo
+ *  em uma única linha de cache; a memória e a tela vêm em seguida.
+ */
+class alignas(64) Chip8 {
+public:
+    //situação da máquina
+    enum Status {
+        RUNNING, //executando normalmente
+        EXITED,  //a ROM executou a instrução EXIT (00FD)
+        CRASHED, //instrução inválida ou não implementada
+        WAITING  //LD Vx, K sem tecla; só existe dentro de run(), que volta para RUNNING
+    };
+
+    //motores de execução disponíveis
+    enum Engine {
+        ENGINE_CACHED,   //interpretador com cache de instruções decodificadas (padrão)
+        ENGINE_THREADED, //goto computado, uma tabela de rótulos indexada pelo opcode
+        ENGINE_JIT       //blocos básicos traduzidos para código x86-64 (jit.h)
+    };
+
+    //registradores
+    byte V[16];                   //V0-VE: Propósito Geral; VF: Carry, Borrow e Detectção de Colisões
+    word I, PC, SP;               //I: Registrador de índice; PC: Contador de Programa; SP: Stack Pointer (Ponteiro da Pilha)
+    byte delayTimer, soundTimer;  //registradores de timer que contam a 60hz
+
+    //pilha de chamadas (call stack)
+    word stack[stackLevels];
+
+    //controle da emulação
+    byte status;                  //um dos valores de Status
+    bool beep;                    //o timer de som contou desde o último runFrame()
+    bool waiting;                 //o último run() terminou esperando uma tecla (LD Vx, K)
+    bool dirty;                   //a tela mudou desde que o frontend a desenhou pela última vez
+    word badInstr;                //instrução que causou o CRASHED
+    unsigned clockHz;             //instruções por segundo de tempo emulado
+    unsigned timerPhase;          //tempo desde o último tick dos timers, em 1/(TIMER_HZ*clockHz) s
+    byte engine;                  //um dos valores de Engine
+    unsigned seed;                //estado do gerador de números aleatórios (nextRandom) desta instância
+    bool idleSkip;                //pula os laços ociosos (padrão: ligado)
+    unsigned long long idleCycles; //instruções puladas em laços ociosos
+    TraceBuffer* trace;           //rastreamento de cada instrução (NULL: desligado); não pertence à máquina
+    TraceFile*   traceFile;       //rastreamento binário em arquivo (NULL: desligado); não pertence à máquina
+    Profiler*    profile;         //profiler (profile.h; NULL: desligado); não pertence à máquina
+
+    //teclado
+    byte key[16];
+
+    //memória gráfica (tela): uma linha por palavra, o bit mais significativo é a coluna 0
+    uint64_t display[displayHeight];
+
+    //memória principal: armazena as fontes e a ROM
+    Memory memory;
+
+    //blocos compilados pelo motor JIT (criados na primeira execução com ENGINE_JIT)
+    JitRef jit;
+
+    Chip8();
+
+    void startup();
+    bool loadROM(const char* filename);
+    void step();
+    int  run(int cycles);
+    int  runFrame();
+    int  cyclesToTick() const;
+
+    //save state (snapshot.h)
+    size_t snapshot(byte* out, size_t size) const;
+    bool restore(const byte* in, size_t size);
+    bool saveState(const char* filename) const;
+    bool loadState(const char* filename);
+
+    bool pixel(int x, int y) const;
+    uint64_t displayHash() const;
+
+    void printState() const;
+    void printMemoryFile() const;
+
+private:
+    friend class Jit;
+    friend class Batch;
+    friend class Memory;
+
+    void notImplemented(word instr);
+    void clearDisplay();
+    void draw(byte x, byte y, byte height);
+    void storeBCD(byte Vx);
+    void waitKey(byte& Vx);
+    void readRegistersFromMem(byte x);
+    void writeRegistersToMem(byte x);
+
+    static void decode(word instr, Instr& in);
+    const Instr& fetch(word addr, Instr& tmp);
+    void invalidate(word addr);
+    void tickTimers();
+    void advanceClock(int cycles);
+    template <class Tracer> void execute(Tracer& tracer);
+    int  interpret(int cycles);
+    int  skipIdle(int cycles);
+    int  runEngine(int cycles);
+    int  runThreaded(int cycles);
+    int  runJit(int cycles);
+
+    static void opCLS(Chip8& c, const Instr& in);
+    static void opRET(Chip8& c, const Instr& in);
+    static void opEXIT(Chip8& c, const Instr& in);
+    static void opSYS(Chip8& c, const Instr& in);
+    static void opJP(Chip8& c, const Instr& in);
+    static void opCALL(Chip8& c, const Instr& in);
+    static void opSEbyte(Chip8& c, const Instr& in);
+    static void opSNEbyte(Chip8& c, const Instr& in);
+    static void opSEreg(Chip8& c, const Instr& in);
+    static void opLDbyte(Chip8& c, const Instr& in);
+    static void opADDbyte(Chip8& c, const Instr& in);
+    static void opLDreg(Chip8& c, const Instr& in);
+    static void opOR(Chip8& c, const Instr& in);
+    static void opAND(Chip8& c, const Instr& in);
+    static void opXOR(Chip8& c, const Instr& in);
+    static void opADDreg(Chip8& c, const Instr& in);
+    static void opSUB(Chip8& c, const Instr& in);
+    static void opSHR(Chip8& c, const Instr& in);
+    static void opSUBN(Chip8& c, const Instr& in);
+    static void opSHL(Chip8& c, const Instr& in);
+    static void opSNEreg(Chip8& c, const Instr& in);
+    static void opLDI(Chip8& c, const Instr& in);
+    static void opJPV0(Chip8& c, const Instr& in);
+    static void opRND(Chip8& c, const Instr& in);
+    static void opDRW(Chip8& c, const Instr& in);
+    static void opSKP(Chip8& c, const Instr& in);
+    static void opSKNP(Chip8& c, const Instr& in);
+    static void opLDVxDT(Chip8& c, const Instr& in);
+    static void opLDVxK(Chip8& c, const Instr& in);
+    static void opLDDT(Chip8& c, const Instr& in);
+    static void opLDST(Chip8& c, const Instr& in);
+    static void opADDI(Chip8& c, const Instr& in);
+    static void opLDF(Chip8& c, const Instr& in);
+    static void opLDB(Chip8& c, const Instr& in);
+    static void opLDIVx(Chip8& c, const Instr& in);
+    static void opLDVxI(Chip8& c, const Instr& in);
+    static void opInvalid(Chip8& c, const Instr& in);
+};
+
+#include "trace.h"
+#include "profile.h"
+
+inline Chip8::Chip8() {
+    clockHz = EMULATOR_CLOCK;
+    engine = ENGINE_CACHED;
+    trace = NULL;
+    traceFile = NULL;
+    profile = NULL;
+    seed = 0;
+    idleSkip = true;
+    idleCycles = 0;
+    startup();
+}
+
+/* Inicializa as estruturas (análogo a um "boot") */
+inline void Chip8::startup() {
+    PC = 0x200;         //o sistema espera que a ROM esteja carregada em 0x200
+    I  = 0;             //inicializa o registrador de índice
+    SP = 0;             //inicializa o ponteiro da pilha
+    delayTimer = 0;     //inicializa o delay timer
+    soundTimer = 0;     //inicializa o timer de som
+    timerPhase = 0;     //o próximo tick dos timers acontece daqui a 1/60s
+
+    status = RUNNING;
+    beep = false;
+    waiting = false;
+    badInstr = 0;
+
+    //inicializa os registradores V0-VF
+    memset(V, 0, sizeof(V));
+
+    //limpa a pilha de chamadas
+    memset(stack, 0, sizeof(stack));
+
+    //limpa a memória e carrega o fontset
+    memory = Memory::boot();
+
+    //limpa a memória gráfica
+    memset(display, 0, sizeof(display));
+    dirty = true;
+
+    //descarta o código compilado
+    jit.reset();
+
+    //limpa o teclado
+    memset(key, 0, sizeof(key));
+}
+
+/* Registra que a instrução não foi implementada e interrompe a emulação (o frontend exibe a mensagem) */
+inline void Chip8::notImplemented(word instr) {
+    badInstr = instr;
+    status = CRASHED;
+}
+
+/* Imprime o valor dos registradores */
+inline void Chip8::printState() const {
+    printRegisters(stdout, V, I, SP);
+}
+
+/* Exporta os dados da memória em um arquivo externo (memory.txt) para fins de debug */
+inline void Chip8::printMemoryFile() const {
+    FILE* file = fopen("memory.txt","w");
+    if (file == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < memSize; i++) {
+        fprintf(file, "[0x%.4x]\t0x%.4x\n", i, memory[i]);
+    }
+
+    fclose(file);
+}
+
+/* Limpa a memória gráfica (tela) */
+inline void Chip8::clearDisplay() {
+    memset(display, 0, sizeof(display));
+    dirty = true;
+}
+
+/*  Desenha um sprite de uma determinado altura e largura 8 na tela a partir da coord (x,y).
+ *  A localização do sprite é endereçada pelo registrador I.
+ *  Cada linha do sprite é deslocada (com rotação, para dar a volta na borda) até a
+ *  coluna x e combinada com a linha da tela em uma única operação XOR.
+ */
+inline void Chip8::draw(byte x, byte y, byte height) {
+    uint64_t collision = 0;
+
+    x = x%64;
+    y = y%32;
+
+    for (int yline = 0; yline < height; yline++) {
+        uint64_t row = (uint64_t) memory[(I + yline) & memMask] << 56;
+        row = (row >> x) | (row << ((64 - x) & 63));
+
+        uint64_t& line = display[(y + yline) % displayHeight];
+        collision |= line & row;
+        line ^= row;
+    }
+
+    V[0xF] = (collision != 0);
+    dirty = true;
+}
+
+/* Informa se o pixel (x,y) está aceso */
+inline bool Chip8::pixel(int x, int y) const {
+    return (display[y] >> (63 - x)) & 1;
+}
+
+/* Hash (FNV-1a de 64 bits) da tela, para comparar execuções sem guardar a imagem */
+inline uint64_t Chip8::displayHash() const {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    //byte a byte, da esquerda para a direita, independente da ordem dos bytes da CPU
+    for (int i = 0; i < displayHeight; i++) {
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            hash ^= (display[i] >> shift) & 0xFF;
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
+
+/* Converte o valor de Vx para BCD e grava na memória a partir do endereço em I */
+inline void Chip8::storeBCD(byte Vx) {
+    memory.write(I & memMask, Vx / 100);
+    memory.write((I + 1) & memMask, (Vx / 10) % 10);
+    memory.write((I + 2) & memMask, (Vx % 100) % 10);
+
+    for (int i = 0; i < 3; i++) {
+        invalidate(I + i);
+    }
+}
+
+/*  Espera por uma tecla ser pressionada. Sem tecla, o PC volta para esta instrução
+ *  e a máquina fica em WAITING: o motor para e run() deixa o tempo passar.
+ */
+inline void Chip8::waitKey(byte& Vx) {
+    bool pressed = false;
+
+    for (int i = 0; i<0xF; i++) {
+        if (key[i]) {
+            Vx = i;
+            pressed = true;
+        }
+    }
+
+    if (!pressed) {
+        PC -= 2;
+        status = WAITING;
+    }
+}
+
+/* Lê os registradores da memória */
+inline void Chip8::readRegistersFromMem(byte x) {
+    for (int i = 0; i <= x; ++i) {
+        V[i] = memory[(I + i) & memMask];
+    }
+
+    I += x + 1;
+}
+
+/* Escreve os registradores na memória */
+inline void Chip8::writeRegistersToMem(byte x) {
+    for (int i = 0; i <= x; ++i) {
+        memory.write((I + i) & memMask, V[i]);
+        invalidate(I + i);
+    }
+
+    I += x + 1;
+}
+
+/* Escreve o mnemônico da instrução em out (disassembler usado para debug) */
+inline void disassemble(word instr, char* out, size_t size) {
+    byte p   = ((instr & 0xF000) >> 12);
+    byte x   = ((instr & 0x0F00) >> 8);
+    byte y   = ((instr & 0x00F0) >> 4);
+    byte kk  = (instr & 0x00FF);
+    word nnn = (instr & 0x0FFF);
+    byte n   = (instr & 0x000F);
+
+    out[0] = '\0';
+    switch (p) {
+        case 0x0:
+            switch (kk) {
+                case 0xE0: snprintf(out, size, "CLS"); break;
+                case 0xEE: snprintf(out, size, "RET"); break;
+                case 0xFD: snprintf(out, size, "EXIT"); break;
+                default:   snprintf(out, size, "SYS 0x%x (ignoring)", nnn); break;
+            }
+            break;
+        case 0x1: snprintf(out, size, "JP 0x%x", nnn); break;
+        case 0x2: snprintf(out, size, "CALL 0x%x", nnn); break;
+        case 0x3: snprintf(out, size, "SE V%x, #%d", x, (sbyte) kk); break;
+        case 0x4: snprintf(out, size, "SNE V%x, #%d", x, (sbyte) kk); break;
+        case 0x5: snprintf(out, size, "SE V%x, V%x", x, y); break;
+        case 0x6: snprintf(out, size, "LD V%x, #%d", x, (sbyte) kk); break;
+        case 0x7: snprintf(out, size, "ADD V%x, #%d", x, kk); break;
+        case 0x8:
+            switch (n) {
+                case 0x0: snprintf(out, size, "LD V%x, V%x", x, y); break;
+                case 0x1: snprintf(out, size, "OR V%x, V%x", x, y); break;
+                case 0x2: snprintf(out, size, "AND V%x, V%x", x, y); break;
+                case 0x3: snprintf(out, size, "XOR V%x, V%x", x, y); break;
+                case 0x4: snprintf(out, size, "ADD V%x, V%x", x, y); break;
+                case 0x5: snprintf(out, size, "SUB V%x, V%x", x, y); break;
+                case 0x6: snprintf(out, size, "SHR V%x {, V%x}", x, y); break;
+                case 0x7: snprintf(out, size, "SUBN V%x, V%x", x, y); break;
+                case 0xE: snprintf(out, size, "SHL V%x {, V%x}", x, y); break;
+            }
+            break;
+        case 0x9: snprintf(out, size, "SNE V%x, V%x", x, y); break;
+        case 0xA: snprintf(out, size, "LD I, 0x%x", nnn); break;
+        case 0xB: snprintf(out, size, "JP V0, 0x%x", nnn); break;
+        case 0xC: snprintf(out, size, "RND V0, 0x%x", (sbyte) kk); break;
+        case 0xD: snprintf(out, size, "DRW V%x, V%x, 0x%x", x, y, n); break;
+        case 0xE:
+            switch (kk) {
+                case 0x9E: snprintf(out, size, "SKP V%x", x); break;
+                case 0xA1: snprintf(out, size, "SKNP V%x", x); break;
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07: snprintf(out, size, "LD V%x, DT", x); break;
+                case 0x0A: snprintf(out, size, "LD V%x, K", x); break;
+                case 0x15: snprintf(out, size, "LD DT, V%x", x); break;
+                case 0x18: snprintf(out, size, "LD ST, V%x", x); break;
+                case 0x1E: snprintf(out, size, "ADD I, V%x", x); break;
+                case 0x29: snprintf(out, size, "LD F, V%x", x); break;
+                case 0x33: snprintf(out, size, "LD B, V%x", x); break;
+                case 0x55: snprintf(out, size, "LD [I], V%x", x); break;
+                case 0x65: snprintf(out, size, "LD V%x. [I]", x); break;
+            }
+            break;
+    }
+}
+
+/*  Implementação das instruções.
+ *  Cada handler recebe a instrução já decodificada; o PC já aponta para a próxima instrução.
+ */
+inline void Chip8::opCLS(Chip8& c, const Instr&) { //CLS
+    c.clearDisplay();
+}
+
+inline void Chip8::opRET(Chip8& c, const Instr&) { //RET
+    c.SP = (c.SP - 1) & (stackLevels - 1);
+    c.PC = c.stack[c.SP];
+}
+
+inline void Chip8::opEXIT(Chip8& c, const Instr&) { //EXIT
+    c.status = EXITED;
+}
+
+inline void Chip8::opSYS(Chip8&, const Instr&) { //SYS addr (ignorada)
+}
+
+inline void Chip8::opJP(Chip8& c, const Instr& in) { //JP addr
+    c.PC = in.nnn;
+}
+
+inline void Chip8::opCALL(Chip8& c, const Instr& in) { //CALL addr
+    c.stack[c.SP] = c.PC;
+    c.SP = (c.SP + 1) & (stackLevels - 1);
+    c.PC = in.nnn;
+}
+
+inline void Chip8::opSEbyte(Chip8& c, const Instr& in) { //SE Vx, byte
+    if (c.V[in.x] == in.kk) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opSNEbyte(Chip8& c, const Instr& in) { //SNE Vx, byte
+    if (c.V[in.x] != in.kk) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opSEreg(Chip8& c, const Instr& in) { //SE Vx, Vy
+    if (c.V[in.x] == c.V[in.y]) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opLDbyte(Chip8& c, const Instr& in) { //LD Vx, byte
+    c.V[in.x] = in.kk;
+}
+
+inline void Chip8::opADDbyte(Chip8& c, const Instr& in) { //ADD Vx, byte
+    c.V[in.x] += in.kk;
+}
+
+inline void Chip8::opLDreg(Chip8& c, const Instr& in) { //LD  Vx, Vy
+    c.V[in.x] = c.V[in.y];
+}
+
+inline void Chip8::opOR(Chip8& c, const Instr& in) { //OR  Vx, Vy
+    c.V[in.x] |= c.V[in.y];
+}
+
+inline void Chip8::opAND(Chip8& c, const Instr& in) { //AND Vx, Vy
+    c.V[in.x] &= c.V[in.y];
+}
+
+inline void Chip8::opXOR(Chip8& c, const Instr& in) { //XOR Vx, Vy
+    c.V[in.x] ^= c.V[in.y];
+}
+
+inline void Chip8::opADDreg(Chip8& c, const Instr& in) { //ADD Vx, Vy
+    word tmp = c.V[in.x] + c.V[in.y];
+    c.V[0xF] = (tmp >> 8);
+    c.V[in.x] = tmp;
+}
+
+inline void Chip8::opSUB(Chip8& c, const Instr& in) { //SUB Vx, Vy
+    word tmp = c.V[in.x] - c.V[in.y];
+    c.V[0xF] = !(tmp >> 8);
+    c.V[in.x] = tmp;
+}
+
+inline void Chip8::opSHR(Chip8& c, const Instr& in) { //SHR Vx {, Vy}
+    c.V[0xF] = c.V[in.y] & 1;
+    c.V[in.x] = c.V[in.y] << 1;
+}
+
+inline void Chip8::opSUBN(Chip8& c, const Instr& in) { //SUBN Vx, Vy
+    word tmp = c.V[in.y] - c.V[in.x];
+    c.V[0xF] = !(tmp >> 8);
+    c.V[in.x] = tmp;
+}
+
+inline void Chip8::opSHL(Chip8& c, const Instr& in) { //SHL Vx {, Vy}
+    c.V[0xF] = c.V[in.y] >> 7;
+    c.V[in.x] = c.V[in.y] >> 1;
+}
+
+inline void Chip8::opSNEreg(Chip8& c, const Instr& in) { //SNE Vx, Vy
+    if (c.V[in.x] != c.V[in.y]) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opLDI(Chip8& c, const Instr& in) { //LD I, addr
+    c.I = in.nnn;
+}
+
+inline void Chip8::opJPV0(Chip8& c, const Instr& in) { //JP V0, addr
+    c.PC = c.V[0] + in.nnn;
+}
+
+inline void Chip8::opRND(Chip8& c, const Instr& in) { //RND Vx, byte
+    c.V[in.x] = nextRandom(c.seed) & in.kk;
+}
+
+inline void Chip8::opDRW(Chip8& c, const Instr& in) { //DRW Vx, Vy, nibble
+    c.draw(c.V[in.x], c.V[in.y], in.n);
+}
+
+inline void Chip8::opSKP(Chip8& c, const Instr& in) { //SKP Vx
+    if (c.key[c.V[in.x] & 0xF]) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opSKNP(Chip8& c, const Instr& in) { //SKNP Vx
+    if (!c.key[c.V[in.x] & 0xF]) {
+        c.PC += 2;
+    }
+}
+
+inline void Chip8::opLDVxDT(Chip8& c, const Instr& in) { //LD Vx, DT
+    c.V[in.x] = c.delayTimer;
+}
+
+inline void Chip8::opLDVxK(Chip8& c, const Instr& in) { //LD Vx, K
+    c.waitKey(c.V[in.x]);
+}
+
+inline void Chip8::opLDDT(Chip8& c, const Instr& in) { //LD DT, Vx
+    c.delayTimer = c.V[in.x];
+}
+
+inline void Chip8::opLDST(Chip8& c, const Instr& in) { //LD ST, Vx
+    c.soundTimer = c.V[in.x];
+}
+
+inline void Chip8::opADDI(Chip8& c, const Instr& in) { //ADD I, Vx
+    c.I += c.V[in.x];
+}
+
+inline void Chip8::opLDF(Chip8& c, const Instr& in) { //LD F, Vx
+    c.I = c.V[in.x]*0x5;
+}
+
+inline void Chip8::opLDB(Chip8& c, const Instr& in) { //LD B, Vx
+    c.storeBCD(c.V[in.x]);
+}
+
+inline void Chip8::opLDIVx(Chip8& c, const Instr& in) { //LD [I], Vx
+    c.writeRegistersToMem(in.x);
+}
+
+inline void Chip8::opLDVxI(Chip8& c, const Instr& in) { //LD Vx, [I]
+    c.readRegistersFromMem(in.x);
+}
+
+inline void Chip8::opInvalid(Chip8& c, const Instr& in) { //opcode inválido
+    c.notImplemented(in.instr);
+}
+
+/* Classifica uma instrução, devolvendo seu identificador (Op) */
+inline byte opIndex(word instr) {
+    byte p  = ((instr & 0xF000) >> 12);
+    byte kk = (instr & 0x00FF);
+    byte n  = (instr & 0x000F);
+
+    switch (p) {
+        case 0x0:
+            switch (kk) {
+                case 0xE0: return OP_CLS;  //CLS
+                case 0xEE: return OP_RET;  //RET
+                case 0xFD: return OP_EXIT; //EXIT
+                default:   return OP_SYS;  //SYS addr
+            }
+        case 0x1: return OP_JP;       //JP addr
+        case 0x2: return OP_CALL;     //CALL addr
+        case 0x3: return OP_SE_BYTE;  //SE Vx, byte
+        case 0x4: return OP_SNE_BYTE; //SNE Vx, byte
+        case 0x5: return OP_SE_REG;   //SE Vx, Vy
+        case 0x6: return OP_LD_BYTE;  //LD Vx, byte
+        case 0x7: return OP_ADD_BYTE; //ADD Vx, byte
+        case 0x8:
+            switch (n) {
+                case 0x0: return OP_LD_REG;  //LD  Vx, Vy
+                case 0x1: return OP_OR;      //OR  Vx, Vy
+                case 0x2: return OP_AND;     //AND Vx, Vy
+                case 0x3: return OP_XOR;     //XOR Vx, Vy
+                case 0x4: return OP_ADD_REG; //ADD Vx, Vy
+                case 0x5: return OP_SUB;     //SUB Vx, Vy
+                case 0x6: return OP_SHR;     //SHR Vx {, Vy}
+                case 0x7: return OP_SUBN;    //SUBN Vx, Vy
+                case 0xE: return OP_SHL;     //SHL Vx {, Vy}
+            }
+            break;
+        case 0x9: return OP_SNE_REG;  //SNE Vx, Vy
+        case 0xA: return OP_LD_I;     //LD I, addr
+        case 0xB: return OP_JP_V0;    //JP V0, addr
+        case 0xC: return OP_RND;      //RND Vx, byte
+        case 0xD: return OP_DRW;      //DRW Vx, Vy, nibble
+        case 0xE:
+            switch (kk) {
+                case 0x9E: return OP_SKP;  //SKP Vx
+                case 0xA1: return OP_SKNP; //SKNP Vx
+            }
+            break;
+        case 0xF:
+            switch (kk) {
+                case 0x07: return OP_LD_VX_DT; //LD Vx, DT
+                case 0x0A: return OP_LD_VX_K;  //LD Vx, K
+                case 0x15: return OP_LD_DT;    //LD DT, Vx
+                case 0x18: return OP_LD_ST;    //LD ST, Vx
+                case 0x1E: return OP_ADD_I;    //ADD I, Vx
+                case 0x29: return OP_LD_F;     //LD F, Vx
+                case 0x33: return OP_LD_B;     //LD B, Vx
+                case 0x55: return OP_LD_I_VX;  //LD [I], Vx
+                case 0x65: return OP_LD_VX_I;  //LD Vx, [I]
+            }
+            break;
+    }
+
+    return OP_INVALID;
+}
+
+/*  Instruções permitidas em um laço ocioso: não escrevem na memória, na tela, nos
+ *  timers nem no gerador de números aleatórios, e não param a máquina. Só leem
+ *  e alteram registradores, I, PC e a pilha.
+ */
+inline bool idleSafe(byte op) {
+    switch (op) {
+        case OP_SYS: case OP_JP: case OP_CALL: case OP_RET: case OP_SE_BYTE: case OP_SNE_BYTE:
+        case OP_SE_REG: case OP_SNE_REG: case OP_LD_BYTE: case OP_ADD_BYTE: case OP_LD_REG: case OP_OR:
+        case OP_AND: case OP_XOR: case OP_ADD_REG: case OP_SUB: case OP_SHR: case OP_SUBN: case OP_SHL:
+        case OP_LD_I: case OP_JP_V0: case OP_SKP: case OP_SKNP: case OP_LD_VX_DT: case OP_ADD_I:
+        case OP_LD_F: case OP_LD_VX_I:
+            return true;
+    }
+    return false;
+}
+
+/* Decodifica uma instrução: extrai os operandos e escolhe o handler que a executa */
+inline void Chip8::decode(word instr, Instr& in) {
+    //mesma ordem do enum Op
+    static const Handler handlers[OP_COUNT] = {
+        opCLS, opRET, opEXIT, opSYS, opJP, opCALL, opSEbyte, opSNEbyte, opSEreg, opLDbyte, opADDbyte,
+        opLDreg, opOR, opAND, opXOR, opADDreg, opSUB, opSHR, opSUBN, opSHL, opSNEreg, opLDI, opJPV0,
+        opRND, opDRW, opSKP, opSKNP, opLDVxDT, opLDVxK, opLDDT, opLDST, opADDI, opLDF, opLDB,
+        opLDIVx, opLDVxI, opInvalid
+    };
+
+    //extrai os bits da instrução
+    in.instr = instr;
+    in.nnn   = (instr & 0x0FFF);
+    in.x     = ((instr & 0x0F00) >> 8);
+    in.y     = ((instr & 0x00F0) >> 4);
+    in.kk    = (instr & 0x00FF);
+    in.n     = (instr & 0x000F);
+    in.exec  = handlers[opIndex(instr)];
+}
+
+/*  Busca a instrução decodificada no endereço addr.
+ *  As páginas da memória guardam as instruções já decodificadas; apenas a que
+ *  começa no último byte de uma página é decodificada em tmp a cada execução.
+ */
+inline const Instr& Chip8::fetch(word addr, Instr& tmp) {
+    addr &= memMask;
+    if ((addr & pageMask) == pageMask) {
+        decode((memory[addr] << 8) | memory[(addr + 1) & memMask], tmp);
+        return tmp;
+    }
+
+    return memory.code(addr);
+}
+
+/*  Descarta o código compilado que usa o byte de memória addr
+ *  (as instruções decodificadas são refeitas pela própria escrita na memória)
+ */
+inline void Chip8::invalidate(word addr) {
+    if (jit.ptr != NULL) {
+        jitInvalidate(jit.ptr, addr & memMask);
+    }
+}
+
+/* Memória inicial: todas as páginas apontam para a página zerada compartilhada */
+inline Memory::Memory() {
+    MemPage* zero = zeroPage();
+    for (int i = 0; i < pageCount; i++) {
+        zero->refs.fetch_add(1, std::memory_order_relaxed);
+        page[i] = zero;
+    }
+}
+
+/* Cópia: as páginas passam a ser compartilhadas pelas duas memórias */
+inline Memory::Memory(const Memory& other) {
+    for (int i = 0; i < pageCount; i++) {
+        other.page[i]->refs.fetch_add(1, std::memory_order_relaxed);
+        page[i] = other.page[i];
+    }
+}
+
+inline Memory& Memory::operator=(const Memory& other) {
+    for (int i = 0; i < pageCount; i++) {
+        other.page[i]->refs.fetch_add(1, std::memory_order_relaxed);
+        release(page[i]);
+        page[i] = other.page[i];
+    }
+    return *this;
+}
+
+inline Memory::~Memory() {
+    for (int i = 0; i < pageCount; i++) {
+        release(page[i]);
+    }
+}
+
+/* Mesmo conteúdo? Páginas compartilhadas nem precisam ser comparadas */
+inline bool Memory::operator==(const Memory& other) const {
+    for (int i = 0; i < pageCount; i++) {
+        if (page[i] != other.page[i] && memcmp(page[i]->data, other.page[i]->data, pageSize) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Escreve um byte, duplicando a página antes se ela for compartilhada */
+inline void Memory::write(int addr, byte value) {
+    int offset = addr & pageMask;
+    if (page[addr >> pageShift]->data[offset] == value) {
+        return; //nada muda: a página continua compartilhada
+    }
+
+    MemPage* p = own(addr >> pageShift);
+    p->data[offset] = value;
+
+    //a instrução que começa no byte anterior também contém addr
+    decode(p, offset);
+    if (offset > 0) {
+        decode(p, offset - 1);
+    }
+}
+
+/* Copia size bytes de data para a memória, a partir de addr, uma página por vez */
+inline void Memory::load(int addr, const byte* data, int size) {
+    while (size > 0) {
+        addr &= memMask;
+        int offset = addr & pageMask;
+        int count  = (size < pageSize - offset) ? size : pageSize - offset;
+
+        //trechos iguais não duplicam a página
+        if (memcmp(page[addr >> pageShift]->data + offset, data, count) != 0) {
+            MemPage* p = own(addr >> pageShift);
+            memcpy(p->data + offset, data, count);
+            for (int i = (offset > 0 ? offset - 1 : 0); i < offset + count; i++) {
+                decode(p, i);
+            }
+        }
+
+        addr += count;
+        data += count;
+        size -= count;
+    }
+}
+
+/* Copia size bytes da memória, a partir de addr, para out */
+inline void Memory::copy(int addr, byte* out, int size) const {
+    while (size > 0) {
+        addr &= memMask;
+        int offset = addr & pageMask;
+        int count  = (size < pageSize - offset) ? size : pageSize - offset;
+        memcpy(out, page[addr >> pageShift]->data + offset, count);
+
+        addr += count;
+        out  += count;
+        size -= count;
+    }
+}
+
+/* Zera a memória */
+inline void Memory::clear() {
+    *this = Memory();
+}
+
+/* Memória logo após o boot (só as fontes), compartilhada por todas as máquinas */
+inline const Memory& Memory::boot() {
+    struct Boot {
+        Memory memory;
+        Boot() { memory.load(0, fontset, sizeof(fontset)); }
+    };
+    static const Boot image;
+    return image.memory;
+}
+
+/* Número de páginas que esta memória compartilha com outras */
+inline int Memory::sharedPages() const {
+    int shared = 0;
+    for (int i = 0; i < pageCount; i++) {
+        shared += (page[i]->refs.load(std::memory_order_relaxed) > 1);
+    }
+    return shared;
+}
+
+/* Garante que a página n pertence só a esta memória (copy-on-write) */
+inline MemPage* Memory::own(int n) {
+    MemPage* p = page[n];
+    if (p->refs.load(std::memory_order_acquire) == 1) {
+        return p;
+    }
+
+    page[n] = newPage(p);
+    release(p);
+    return page[n];
+}
+
+/* Cria uma página, cópia de from ou zerada (from NULL), com uma referência */
+inline MemPage* Memory::newPage(const MemPage* from) {
+    MemPage* p = new MemPage;
+    p->refs.store(1, std::memory_order_relaxed);
+    if (from != NULL) {
+        memcpy(p->data, from->data, sizeof(p->data));
+        memcpy(p->code, from->code, sizeof(p->code));
+    } else {
+        memset(p->data, 0, sizeof(p->data));
+        for (int i = 0; i < pageSize; i++) {
+            decode(p, i);
+        }
+    }
+    return p;
+}
+
+/* Página zerada, compartilhada por todas as máquinas; nunca é liberada */
+inline MemPage* Memory::zeroPage() {
+    static MemPage* zero = newPage(NULL);
+    return zero;
+}
+
+/* Solta uma referência; a última libera a página */
+inline void Memory::release(MemPage* p) {
+    if (p->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete p;
+    }
+}
+
+/* Decodifica a instrução que começa em offset (exceto no último byte da página) */
+inline void Memory::decode(MemPage* p, int offset) {
+    if (offset < pageMask) {
+        Chip8::decode((p->data[offset] << 8) | p->data[offset + 1], p->code[offset]);
+    }
+}
+
+/* Um tick dos timers (60hz) */
+inline void Chip8::tickTimers() {
+    if (delayTimer > 0) {
+        delayTimer--;
+    }
+    if (soundTimer > 0) {
+        beep = true; //o frontend reproduz o beep
+        soundTimer--;
+    }
+}
+
+/*  Avança o tempo emulado em cycles instruções, contando os timers a cada 1/60s.
+ *  Cada instrução dura 1/clockHz s, ou seja, TIMER_HZ unidades de timerPhase.
+ */
+inline void Chip8::advanceClock(int cycles) {
+    timerPhase += cycles * TIMER_HZ;
+    while (timerPhase >= clockHz) {
+        timerPhase -= clockHz;
+        tickTimers();
+    }
+}
+
+/* Instruções até o próximo tick dos timers (pelo menos 1) */
+inline int Chip8::cyclesToTick() const {
+    int cycles = (clockHz - timerPhase + TIMER_HZ - 1) / TIMER_HZ;
+    return (cycles > 0) ? cycles : 1;
+}
+
+/*  Emula um ciclo do chip8 (busca, decodifica e executa uma instrução).
+ *  Tracer é a política de rastreamento (trace.h); com NoTrace nenhum código de debug é gerado.
+ */
+template <class Tracer>
+inline void Chip8::execute(Tracer& tracer) {
+    if (status != RUNNING) {
+        return;
+    }
+
+    //busca a instrução já decodificada
+    Instr tmp;
+    const Instr& in = fetch(PC, tmp);
+
+    if (Tracer::enabled) {
+        tracer.record(*this, in.instr);
+    }
+
+    //atualiza PC
+    PC += 2;
+
+    //executa a instrução
+    in.exec(*this, in);
+}
+
+/* Executa até cycles instruções no interpretador, sem rastreamento e sem contar o tempo */
+inline int Chip8::interpret(int cycles) {
+    NoTrace none;
+    int done = 0;
+    while (done < cycles && status == RUNNING) {
+        execute(none);
+        done++;
+    }
+    return done;
+}
+
+/* Emula um ciclo do chip8 (uma instrução, com os timers) */
+inline void Chip8::step() {
+    run(1);
+}
+
+#if defined(__GNUC__)
+/*  Motor "threaded": cada instrução salta direto para a próxima (goto computado),
+ *  sem voltar a um switch central. O opcode completo (16 bits) indexa uma tabela
+ *  com o Op de cada instrução, e o Op indexa a tabela de rótulos.
+ *  O resultado é idêntico ao de step(), mas sem rastreamento.
+ */
+inline int Chip8::runThreaded(int cycles) {
+    //Op de cada uma das 65536 instruções possíveis, montada uma única vez
+    struct OpTable {
+        byte op[0x10000];
+        OpTable() {
+            for (int i = 0; i < 0x10000; i++) {
+                op[i] = opIndex(i);
+            }
+        }
+    };
+    static const OpTable table;
+
+    //mesma ordem do enum Op
+    static const void* const labels[OP_COUNT] = {
+        &&CLS, &&RET, &&EXIT, &&SYS, &&JP, &&CALL, &&SE_BYTE, &&SNE_BYTE, &&SE_REG, &&LD_BYTE, &&ADD_BYTE,
+        &&LD_REG, &&OR, &&AND, &&XOR, &&ADD_REG, &&SUB, &&SHR, &&SUBN, &&SHL, &&SNE_REG, &&LD_I, &&JP_V0,
+        &&RND, &&DRW, &&SKP, &&SKNP, &&LD_VX_DT, &&LD_VX_K, &&LD_DT, &&LD_ST, &&ADD_I, &&LD_F, &&LD_B,
+        &&LD_I_VX, &&LD_VX_I, &&INVALID
+    };
+
+    int  done = 0;
+    word instr, tmp;
+
+    //página do PC, lida sem passar pela tabela de páginas; após escritas na memória
+    //ela pode ter sido duplicada (copy-on-write) e é buscada de novo
+    const byte* page = NULL;
+    int pageBase = memSize, offset;
+
+//operandos da instrução atual
+#define X   ((instr & 0x0F00) >> 8)
+#define Y   ((instr & 0x00F0) >> 4)
+#define KK  (instr & 0x00FF)
+#define NNN (instr & 0x0FFF)
+#define N   (instr & 0x000F)
+
+//busca a próxima instrução e salta para o seu rótulo
+#define DISPATCH()                                                                   \
+    if (done >= cycles) goto end;                                                    \
+    offset = (PC & memMask) - pageBase;                                              \
+    if ((unsigned) offset < (unsigned) pageMask) {                                   \
+        instr = (page[offset] << 8) | page[offset + 1];                              \
+    } else {                                                                         \
+        instr = memory.fetchWord(PC & memMask);                                      \
+        pageBase = PC & memMask & ~pageMask;                                         \
+        page = memory.pageData(pageBase);                                            \
+    }                                                                                \
+    PC += 2;                                                                         \
+    goto *labels[table.op[instr]]
+
+//fim de uma instrução: conta o ciclo e segue para a próxima
+#define NEXT()                                                                       \
+    done++;                                                                          \
+    DISPATCH()
+
+    if (status != RUNNING) {
+        return 0;
+    }
+    DISPATCH();
+
+CLS:      clearDisplay(); NEXT();
+RET:      SP = (SP - 1) & (stackLevels - 1); PC = stack[SP]; NEXT();
+EXIT:     status = EXITED; done++; goto end;
+SYS:      NEXT();
+JP:       PC = NNN; NEXT();
+CALL:     stack[SP] = PC; SP = (SP + 1) & (stackLevels - 1); PC = NNN; NEXT();
+SE_BYTE:  if (V[X] == KK) PC += 2; NEXT();
+SNE_BYTE: if (V[X] != KK) PC += 2; NEXT();
+SE_REG:   if (V[X] == V[Y]) PC += 2; NEXT();
+LD_BYTE:  V[X] = KK; NEXT();
+ADD_BYTE: V[X] += KK; NEXT();
+LD_REG:   V[X] = V[Y]; NEXT();
+OR:       V[X] |= V[Y]; NEXT();
+AND:      V[X] &= V[Y]; NEXT();
+XOR:      V[X] ^= V[Y]; NEXT();
+ADD_REG:  tmp = V[X] + V[Y]; V[0xF] = (tmp >> 8); V[X] = tmp; NEXT();
+SUB:      tmp = V[X] - V[Y]; V[0xF] = !(tmp >> 8); V[X] = tmp; NEXT();
+SHR:      V[0xF] = V[Y] & 1; V[X] = V[Y] << 1; NEXT();
+SUBN:     tmp = V[Y] - V[X]; V[0xF] = !(tmp >> 8); V[X] = tmp; NEXT();
+SHL:      V[0xF] = V[Y] >> 7; V[X] = V[Y] >> 1; NEXT();
+SNE_REG:  if (V[X] != V[Y]) PC += 2; NEXT();
+LD_I:     I = NNN; NEXT();
+JP_V0:    PC = V[0] + NNN; NEXT();
+RND:      V[X] = nextRandom(seed) & KK; NEXT();
+DRW:      draw(V[X], V[Y], N); NEXT();
+SKP:      if (key[V[X] & 0xF]) PC += 2; NEXT();
+SKNP:     if (!key[V[X] & 0xF]) PC += 2; NEXT();
+LD_VX_DT: V[X] = delayTimer; NEXT();
+LD_VX_K:  waitKey(V[X]); if (status != RUNNING) { done++; goto end; } NEXT();
+LD_DT:    delayTimer = V[X]; NEXT();
+LD_ST:    soundTimer = V[X]; NEXT();
+ADD_I:    I += V[X]; NEXT();
+LD_F:     I = V[X]*0x5; NEXT();
+LD_B:     storeBCD(V[X]); pageBase = memSize; NEXT();
+LD_I_VX:  writeRegistersToMem(X); pageBase = memSize; NEXT();
+LD_VX_I:  readRegistersFromMem(X); NEXT();
+INVALID:  notImplemented(instr); done++; goto end;
+
+#undef X
+#undef Y
+#undef KK
+#undef NNN
+#undef N
+#undef DISPATCH
+#undef NEXT
+
+end:
+    return done;
+}
+#else
+/* Sem goto computado (compiladores que não são GNU), o motor threaded usa o interpretador */
+inline int Chip8::runThreaded(int cycles) {
+    return interpret(cycles);
+}
+#endif
+
+/*  Laços ociosos (busy waits).
+ *  A partir do PC, executa no interpretador (em qualquer motor) as instruções enquanto
+ *  forem idleSafe().
+ *  Se o PC voltar ao início com os registradores, I e a pilha iguais aos do início,
+ *  a máquina está em um laço de L instruções que só lê valores que não mudam até o
+ *  próximo tick dos timers (teclado, memória, delay timer): cada volta deixa o estado
+ *  igual, e as voltas restantes até o tick (ou até o fim de cycles, se vier antes)
+ *  são puladas sem executar. Se o laço não
+ *  lê o delay timer, os ticks também não o afetam e são pulados até o fim de cycles.
+ *  Como a primeira volta pode ainda mudar os registradores (Vx recebe o timer),
+ *  o estado do fim dela é a referência da segunda.
+ *  Retorna quantas instruções foram executadas ou puladas (os timers já contados).
+ */
+inline int Chip8::skipIdle(int cycles) {
+    const int maxLoop = 16;       //instruções por volta, no máximo
+
+    //a busca não passa do próximo tick: o delay timer não muda durante as voltas
+    int tick  = cyclesToTick();
+    int end   = (tick < cycles) ? tick : cycles;
+    int limit = (end < 3 * maxLoop) ? end : 3 * maxLoop;
+
+    byte startV[16];
+    word startStack[stackLevels];
+    word startPC = PC, startI = I, startSP = SP;
+    memcpy(startV, V, sizeof(startV));
+    memcpy(startStack, stack, sizeof(startStack));
+
+    bool readsTimer = false, idle = false;
+    int done = 0, length = 0;
+    while (done < limit && length < maxLoop) {
+        Instr tmp;
+        const Instr& in = fetch(PC, tmp);
+        byte op = opIndex(in.instr);
+        if (!idleSafe(op)) {
+            break;
+        }
+        readsTimer |= (op == OP_LD_VX_DT);
+
+        PC += 2;
+        in.exec(*this, in);
+        done++;
+        length++;
+
+        if (PC == startPC) {
+            if (I == startI && SP == startSP && memcmp(V, startV, sizeof(V)) == 0 &&
+                memcmp(stack, startStack, sizeof(stack)) == 0) {
+                idle = true;
+                break;
+            }
+
+            //nova referência: o estado ao fim desta volta
+            memcpy(startV, V, sizeof(startV));
+            memcpy(startStack, stack, sizeof(startStack));
+            startI = I;
+            startSP = SP;
+            length = 0;
+        }
+    }
+
+    int skip = 0;
+    if (idle) {
+        int span = (readsTimer ? end : cycles) - done;
+        skip = span / length * length;
+    }
+
+    advanceClock(done + skip);
+    idleCycles += skip;
+    return done + skip;
+}
+
+/*  Executa até cycles instruções no motor escolhido, sem contar o tempo.
+ *  Só o interpretador faz rastreamento e profiling.
+ */
+inline int Chip8::runEngine(int cycles) {
+    int done = 0;
+
+    if (profile != NULL) {
+        while (done < cycles && status == RUNNING) {
+            execute(*profile);
+            done++;
+        }
+        profile->pause();
+        return done;
+    } else if (traceFile != NULL) {
+        while (done < cycles && status == RUNNING) {
+            execute(*traceFile);
+            done++;
+        }
+        return done;
+    } else if (trace != NULL) {
+        while (done < cycles && status == RUNNING) {
+            execute(*trace);
+            done++;
+        }
+        return done;
+    }
+
+    if (engine == ENGINE_THREADED) {
+        return runThreaded(cycles);
+    } else if (engine == ENGINE_JIT) {
+        return runJit(cycles);
+    }
+    return interpret(cycles);
+}
+
+/*  Escalonador: executa até cycles instruções, em trechos que terminam nos ticks dos
+ *  timers, que acontecem a cada 1/60s de tempo emulado (clockHz/60 instruções),
+ *  independente de quantas instruções o frontend executa por quadro.
+ *  Com idleSkip, antes de cada trecho skipIdle() procura um laço ocioso executando
+ *  até 48 instruções sempre no interpretador, qualquer que seja o motor: com os
+ *  motores threaded e JIT, parte das instruções (e do tempo) é do interpretador.
+ *  Para medir só o motor escolhido, desligue idleSkip.
+ *  Retorna quantas instruções foram executadas.
+ */
+inline int Chip8::run(int cycles) {
+    const int idleMinCycles = 64; //com menos instruções, procurar o laço não compensa
+    bool skipping = idleSkip && trace == NULL && traceFile == NULL && profile == NULL;
+    int done = 0;
+
+    waiting = false;
+
+    while (done < cycles && status == RUNNING) {
+        if (skipping && cycles - done >= idleMinCycles) {
+            done += skipIdle(cycles - done);
+            if (done >= cycles || status != RUNNING) {
+                break;
+            }
+        }
+
+        int chunk = cyclesToTick();
+        if (chunk > cycles - done) {
+            chunk = cycles - done;
+        }
+
+        int executed = runEngine(chunk);
+        if (status == WAITING) {
+            //o teclado não muda durante run(): esperar o resto do tempo daria no mesmo
+            //que repetir LD Vx, K a cada ciclo
+            status = RUNNING;
+            waiting = true;
+            executed = cycles - done;
+        }
+        advanceClock(executed);
+        done += executed;
+    }
+
+    return done;
+}
+
+/* Executa as instruções de um quadro (1/60s, até o próximo tick dos timers); retorna quantas foram executadas */
+inline int Chip8::runFrame() {
+    beep = false;
+    return run(cyclesToTick());
+}
+
+#include "jit.h"
+#include "romcache.h"
+#include "snapshot.h"
+
+#endif
@@ -0,0 +1,250 @@
+/****************************************************************************
+  Execução de muitas ROMs em paralelo (farm), usada pelo emulador headless.
+
+  Cada job é uma ROM executada por uma máquina própria, com seu roteiro de
+  teclas, sua semente e seu limite de instruções. Os jobs são distribuídos
+  entre as threads de trabalho, cada uma com sua própria fila: a thread
+  consome a sua fila pelo fim e, quando ela se esvazia, rouba jobs do início
+  da fila de outra thread (work stealing). Assim jobs longos e curtos se
+  equilibram entre os núcleos sem uma fila central disputada por todos.
+
+  Arquivo de jobs: um job por linha, com os campos separados por espaços:
+      <rom> [roteiro de teclas ou -] [semente] [instruções]
+  Os campos omitidos usam os valores da linha de comando. Linhas vazias ou
+  iniciadas por '#' são ignoradas. No lugar da ROM pode vir um snapshot
+  (snapshot.h), para começar de um estado já aquecido; a semente e o clock
+  vêm então do snapshot. Um movie como roteiro também define a semente e o
+  clock da máquina. Exemplo:
+      roms/PONG   keys/pong.txt  7  100000
+      roms/BRIX   -              3
+*****************************************************************************/
+
+#ifndef CHIP8_FARM_H
+#define CHIP8_FARM_H
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "chip8.h"
+#include "keyscript.h"
+#include "audio.h"
+
+//um job: uma execução independente de uma ROM
+struct FarmJob {
+    std::string   rom;
+    std::string   keys;           //vazio: sem roteiro de teclas
+    unsigned      seed;
+    unsigned long maxCycles;      //0: limitado apenas por maxFrames
+    unsigned long maxFrames;
+};
+
+//resultado de um job, entregue assim que ele termina
+struct FarmResult {
+    size_t        job;            //índice do job na lista
+    bool          loaded;         //a ROM e o roteiro foram carregados
+    byte          status;         //Chip8::Status ao final
+    word          badInstr;
+    unsigned long frames;
+    unsigned long cycles;
+    double        seconds;        //tempo de execução (sem contar a carga da ROM)
+    uint64_t      displayHash;
+    byte          V[16];
+    word          I, PC, SP;
+};
+
+/*  Executa a ROM já carregada quadro a quadro, até um dos limites ou o fim da ROM.
+ *  Não há espera entre os quadros: a emulação roda na velocidade máxima do host.
+ *  Com tone, o som de cada quadro vai para ele (normalmente o backend nulo).
+ */
+inline unsigned long runMachine(Chip8& c, KeyScript& keys, unsigned long maxFrames, unsigned long maxCycles,
+                                unsigned long& frames, Tone* tone = NULL) {
+    unsigned long cycles = 0;
+
+    frames = 0;
+    while (frames < maxFrames && c.status == Chip8::RUNNING) {
+        keys.apply(c, frames);
+
+        //compara antes de subtrair: cycles pode passar de maxCycles se run() exceder o pedido
+        if (maxCycles != 0 && cycles >= maxCycles) {
+            break;
+        }
+        if (maxCycles != 0 && maxCycles - cycles < (unsigned long) c.cyclesToTick()) {
+            c.beep = false;
+            cycles += c.run(maxCycles - cycles); //último quadro, incompleto
+        } else {
+            cycles += c.runFrame();
+        }
+        frames++;
+
+        if (tone != NULL) {
+            tone->tick(c.beep);
+        }
+
+        //o texto do rastreamento é formatado fora do laço de emulação
+        if (c.trace != NULL) {
+            c.trace->flush(stdout);
+        }
+    }
+
+    return cycles;
+}
+
+/* Lê a lista de jobs; os campos omitidos vêm de defaults */
+inline bool loadJobs(const char* filename, const FarmJob& defaults, std::vector<FarmJob>& jobs) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Couldn't open job list: %s\n", filename);
+        return false;
+    }
+
+    char line[1024];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        char rom[512], keys[512];
+        unsigned seed;
+        unsigned long cycles;
+        int fields = sscanf(line, "%511s %511s %u %lu", rom, keys, &seed, &cycles);
+        if (fields <= 0 || rom[0] == '#') {
+            continue;
+        }
+
+        FarmJob job = defaults;
+        job.rom = rom;
+        if (fields >= 2 && strcmp(keys, "-") != 0) {
+            job.keys = keys;
+        }
+        if (fields >= 3) {
+            job.seed = seed;
+        }
+        if (fields >= 4) {
+            job.maxCycles = cycles;
+        }
+        jobs.push_back(job);
+    }
+
+    fclose(file);
+    return true;
+}
+
+/* Thread pool com uma fila de jobs por thread e roubo de trabalho */
+class Farm {
+public:
+    //chamado a cada job terminado, serializado (nunca por duas threads ao mesmo tempo)
+    typedef void (*Callback)(const FarmJob& job, const FarmResult& result);
+
+    Farm(const Chip8& settings, int threads);
+
+    void run(const std::vector<FarmJob>& jobs, Callback done);
+
+private:
+    struct Queue {
+        std::mutex         lock;
+        std::deque<size_t> jobs;
+    };
+
+    const Chip8&       settings;  //motor, clock e idle skip usados por todas as máquinas
+    int                threads;
+    std::vector<Queue> queues;
+    std::mutex         output;
+
+    bool take(int worker, size_t& job);
+    void work(int worker, const std::vector<FarmJob>* jobs, Callback done);
+    void execute(const FarmJob& job, FarmResult& result);
+};
+
+inline Farm::Farm(const Chip8& s, int n) : settings(s), threads(n), queues(n > 0 ? n : 1) {
+    if (threads <= 0) {
+        threads = 1;
+    }
+}
+
+/* Pega o próximo job da própria fila ou, se ela estiver vazia, rouba de outra thread */
+inline bool Farm::take(int worker, size_t& job) {
+    {
+        Queue& own = queues[worker];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (!own.jobs.empty()) {
+            job = own.jobs.back();
+            own.jobs.pop_back();
+            return true;
+        }
+    }
+
+    //os jobs são todos conhecidos de antemão: se nenhuma fila tem trabalho, acabou
+    for (int i = 1; i < threads; i++) {
+        Queue& victim = queues[(worker + i) % threads];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (!victim.jobs.empty()) {
+            job = victim.jobs.front();
+            victim.jobs.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* Executa um job em uma máquina nova */
+inline void Farm::execute(const FarmJob& job, FarmResult& result) {
+    Chip8* machine = new Chip8();
+    machine->engine = settings.engine;
+    machine->clockHz = settings.clockHz;
+    machine->idleSkip = settings.idleSkip;
+    machine->seed = job.seed;
+
+    KeyScript keys;
+    result.loaded = loadProgram(*machine, job.rom.c_str()) && (job.keys.empty() || keys.load(job.keys.c_str()));
+    keys.setup(*machine);
+    result.frames = 0;
+    result.cycles = 0;
+    result.seconds = 0;
+
+    if (result.loaded) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        result.cycles = runMachine(*machine, keys, job.maxFrames, job.maxCycles, result.frames);
+        result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    result.status      = machine->status;
+    result.badInstr    = machine->badInstr;
+    result.displayHash = machine->displayHash();
+    memcpy(result.V, machine->V, sizeof(result.V));
+    result.I  = machine->I;
+    result.PC = machine->PC;
+    result.SP = machine->SP;
+
+    delete machine;
+}
+
+/* Laço de uma thread de trabalho */
+inline void Farm::work(int worker, const std::vector<FarmJob>* jobs, Callback done) {
+    size_t job;
+    while (take(worker, job)) {
+        FarmResult result;
+        result.job = job;
+        execute((*jobs)[job], result);
+
+        std::lock_guard<std::mutex> guard(output);
+        done((*jobs)[job], result);
+    }
+}
+
+/* Executa todos os jobs e retorna quando o último terminar */
+inline void Farm::run(const std::vector<FarmJob>& jobs, Callback done) {
+    //distribuição inicial alternada; o roubo de trabalho corrige o desequilíbrio
+    for (size_t i = 0; i < jobs.size(); i++) {
+        queues[i % threads].jobs.push_back(i);
+    }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.push_back(std::thread(&Farm::work, this, i, &jobs, done));
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+#endif
@@ -0,0 +1,463 @@
+/****************************************************************************
+  Emulador Chip-8 sem janela (headless).
+
+  Executa uma ROM sem SFML, sem áudio e sem mensagens de debug (a não ser que
+  --trace seja usado), e ao final informa o estado da máquina e o tempo de som
+  (o tom passa pelo backend nulo de audio.h). Útil para testes
+  automatizados e para rodar muitas ROMs em lote.
+
+COMPILE:
+"./build.sh" (gera também o executável emulator-headless)
+
+EXECUTE:
+"./emulator-headless nome_da_rom [opções]"
+"./emulator-headless snapshot.c8s [opções]"  (continua a partir de um estado salvo)
+"./emulator-headless --farm lista_de_jobs [opções]"
+
+OPÇÕES:
+--frames N         executa no máximo N quadros (padrão: 600, 10 segundos)
+--cycles N         executa no máximo N instruções
+--keys arquivo     roteiro de teclas ou movie (formato descrito em keyscript.h); a
+                   semente e o clock do movie têm prioridade sobre --seed e --clock, e
+                   sem --frames a execução para no último quadro gravado, conferindo
+                   o hash da tela (termina com 1 se a reprodução divergir)
+--seed N           semente dos números aleatórios (padrão: 0)
+--clock N          instruções por segundo de tempo emulado (padrão: 360); os timers
+                   contam a 60hz desse tempo. A execução não espera entre os quadros:
+                   roda sempre na velocidade máxima do host
+--engine nome      cached, threaded ou jit (padrão: cached)
+--no-idle-skip     executa os laços ociosos instrução por instrução, em vez de pulá-los
+                   (o resultado é o mesmo; útil para comparar o desempenho)
+--trace            imprime registradores e instruções a cada ciclo
+--trace-file arq   grava o rastreamento binário em arq (lido pela ferramenta c8trace);
+                   tem prioridade sobre --trace
+--trace-display    inclui as alterações da tela no rastreamento binário
+--dump             imprime registradores e a tela ao final
+--save-state arq   grava o estado final da máquina em arq (formato de snapshot.h)
+--profile arq      liga o profiler (profile.h): ao final imprime as instruções e o tempo
+                   por Op e os endereços mais quentes, e grava em arq as pilhas de
+                   chamadas em "folded stacks" (flamegraph.pl, speedscope); a máquina
+                   roda no interpretador
+--threads N        com --farm, número de threads (padrão: número de núcleos)
+--preload dir      carrega antes todas as ROMs do diretório no cache de ROMs (romcache.h)
+--lanes N          executa N cópias da ROM em lote (batch.h), com as sementes seed,
+                   seed+1, ... e as mesmas teclas, e imprime o resultado de cada uma
+--verify           com --lanes, executa cada lane também sozinha, no interpretador,
+                   e confere se o estado final é idêntico; sem --lanes, executa a ROM
+                   de novo sem pular laços ociosos e confere se quadros, instruções e
+                   estado final são os mesmos (termina com 1 se não forem)
+
+FARM:
+Com --farm, executa cada job da lista (formato descrito em farm.h) em uma
+máquina própria, em paralelo, e imprime uma linha por job assim que ele
+termina: ROM, semente, situação, quadros, instruções, hash da tela,
+instruções por segundo e os registradores finais. --frames, --cycles,
+--keys e --seed valem para os jobs que não os especificam; --clock, --engine
+e --no-idle-skip valem para todos. --trace, --trace-file, --profile,
+--save-state, --dump, --lanes e --verify não são aceitos com --farm.
+*****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chip8.h"
+#include "keyscript.h"
+#include "farm.h"
+#include "batch.h"
+
+//máquina emulada
+Chip8       chip8;
+TraceBuffer traceBuffer; //usado apenas com --trace
+TraceFile   traceFile;   //usado apenas com --trace-file
+Profiler    profiler;    //usado apenas com --profile
+
+//opções
+unsigned long maxFrames = 600;
+bool          framesSet = false;  //--frames foi usado
+unsigned long maxCycles = 0;      //0: sem limite
+const char*   keysFile  = NULL;
+unsigned      seed      = 0;
+bool          dump      = false;
+const char*   traceName = NULL;   //--trace-file
+const char*   stateName = NULL;   //--save-state
+const char*   profileName = NULL; //--profile
+bool          traceDisplay = false;
+const char*   farmFile  = NULL;   //--farm
+int           threads   = std::thread::hardware_concurrency();
+bool          farmFailed = false; //algum job não carregou ou travou
+int           lanes     = 0;      //--lanes (0: uma única máquina)
+bool          verify    = false;
+
+/* Lê as opções da linha de comando, a partir de argv[first] */
+void parseOptions(int argc, char* argv[], int first) {
+    for (int i = first; i < argc; i++) {
+        bool hasValue = (i + 1 < argc);
+
+        if (strcmp(argv[i], "--frames") == 0 && hasValue) {
+            maxFrames = strtoul(argv[++i], NULL, 0);
+            framesSet = true;
+        } else if (strcmp(argv[i], "--cycles") == 0 && hasValue) {
+            maxCycles = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--keys") == 0 && hasValue) {
+            keysFile = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && hasValue) {
+            seed = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--clock") == 0 && hasValue) {
+            chip8.clockHz = strtoul(argv[++i], NULL, 0);
+            if (chip8.clockHz == 0) {
+                printf("Invalid clock: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--engine") == 0 && hasValue) {
+            i++;
+            if (strcmp(argv[i], "cached") == 0) {
+                chip8.engine = Chip8::ENGINE_CACHED;
+            } else if (strcmp(argv[i], "threaded") == 0) {
+                chip8.engine = Chip8::ENGINE_THREADED;
+            } else if (strcmp(argv[i], "jit") == 0) {
+                chip8.engine = Chip8::ENGINE_JIT;
+            } else {
+                printf("Unknown engine: %s\n", argv[i]);
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--no-idle-skip") == 0) {
+            chip8.idleSkip = false;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            chip8.trace = &traceBuffer;
+        } else if (strcmp(argv[i], "--trace-file") == 0 && hasValue) {
+            traceName = argv[++i];
+        } else if (strcmp(argv[i], "--trace-display") == 0) {
+            traceDisplay = true;
+        } else if (strcmp(argv[i], "--dump") == 0) {
+            dump = true;
+        } else if (strcmp(argv[i], "--save-state") == 0 && hasValue) {
+            stateName = argv[++i];
+        } else if (strcmp(argv[i], "--profile") == 0 && hasValue) {
+            profileName = argv[++i];
+        } else if (strcmp(argv[i], "--preload") == 0 && hasValue) {
+            if (RomCache::shared().preload(argv[++i]) < 0) {
+                exit(1);
+            }
+        } else if (strcmp(argv[i], "--threads") == 0 && hasValue) {
+            threads = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--lanes") == 0 && hasValue) {
+            lanes = strtoul(argv[++i], NULL, 0);
+        } else if (strcmp(argv[i], "--verify") == 0) {
+            verify = true;
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            exit(1);
+        }
+    }
+}
+
+/* Imprime o relatório do profiler e grava as pilhas em profileName, com o nome da ROM na raiz */
+bool writeProfile(const char* rom) {
+    FILE* file = fopen(profileName, "w");
+    if (file == NULL) {
+        printf("Couldn't create profile: %s\n", profileName);
+        return false;
+    }
+
+    const char* name = strrchr(rom, '/');
+    profiler.writeFolded(file, (name != NULL) ? name + 1 : rom);
+    fclose(file);
+
+    profiler.print(stdout);
+    printf("\n");
+    return true;
+}
+
+/* Imprime a tela em texto ('#' aceso, '.' apagado) */
+void printDisplay() {
+    for (int i = 0; i < displayHeight; i++) {
+        for (int j = 0; j < displayWidth; j++) {
+            putchar(chip8.pixel(j, i) ? '#' : '.');
+        }
+        putchar('\n');
+    }
+}
+
+/* Imprime o resultado de um job da farm (chamado por uma thread de cada vez) */
+void printJob(const FarmJob& job, const FarmResult& result) {
+    static const char* statusNames[] = {"running", "exited", "crashed"};
+
+    farmFailed |= !result.loaded || result.status == Chip8::CRASHED;
+    if (!result.loaded) {
+        printf("job %zu\t%s\tseed %u\terror\n", result.job, job.rom.c_str(), job.seed);
+        fflush(stdout);
+        return;
+    }
+
+    double ips = (result.seconds > 0) ? result.cycles / result.seconds : 0;
+    printf("job %zu\t%s\tseed %u\t%s\tframes %lu\tcycles %lu\tdisplay %.16llx\t%.0f instr/s\t",
+           result.job, job.rom.c_str(), job.seed, statusNames[result.status], result.frames, result.cycles,
+           (unsigned long long) result.displayHash, ips);
+    for (int i = 0; i <= 0xF; i++) {
+        printf("%.2x ", result.V[i]);
+    }
+    printf("I %.4x PC %.4x SP %.4x\n", result.I, result.PC, result.SP);
+    fflush(stdout);
+}
+
+/* Executa a lista de jobs em paralelo; retorna 1 se algum falhou */
+int runFarm() {
+    FarmJob defaults;
+    defaults.keys      = (keysFile != NULL) ? keysFile : "";
+    defaults.seed      = seed;
+    defaults.maxCycles = maxCycles;
+    defaults.maxFrames = maxFrames;
+
+    std::vector<FarmJob> jobs;
+    if (!loadJobs(farmFile, defaults, jobs)) {
+        return 1;
+    }
+
+    Farm farm(chip8, threads);
+    farm.run(jobs, printJob);
+    return farmFailed ? 1 : 0;
+}
+
+/* Estado final de duas máquinas é idêntico? */
+bool sameState(const Chip8& a, const Chip8& b) {
+    return memcmp(a.V, b.V, sizeof(a.V)) == 0 && a.I == b.I && a.PC == b.PC && a.SP == b.SP &&
+           memcmp(a.stack, b.stack, sizeof(a.stack)) == 0 && a.delayTimer == b.delayTimer &&
+           a.soundTimer == b.soundTimer && a.timerPhase == b.timerPhase && a.status == b.status &&
+           a.seed == b.seed &&
+           memcmp(a.display, b.display, sizeof(a.display)) == 0 &&
+           a.memory == b.memory;
+}
+
+/* Executa a ROM já carregada em várias lanes, em lote; retorna 1 se alguma lane falhou */
+int runBatch(KeyScript& keys) {
+    static const char* statusNames[] = {"running", "exited", "crashed"};
+
+    Batch batch(chip8, lanes);
+    for (int l = 0; l < lanes; l++) {
+        batch.lane(l).seed = seed + l;
+    }
+
+    //executa quadro a quadro até atingir um dos limites ou todas as lanes terminarem
+    unsigned long frames = 0, cycles = 0;
+    while (frames < maxFrames && (maxCycles == 0 || cycles < maxCycles)) {
+        //as teclas do roteiro valem para todas as lanes
+        byte previous[16];
+        memcpy(previous, chip8.key, sizeof(previous));
+        keys.apply(chip8, frames);
+        if (memcmp(previous, chip8.key, sizeof(previous)) != 0) {
+            for (int l = 0; l < lanes; l++) {
+                memcpy(batch.lane(l).key, chip8.key, sizeof(chip8.key));
+            }
+        }
+
+        int done;
+        if (maxCycles != 0 && maxCycles - cycles < (unsigned long) batch.cyclesToTick()) {
+            done = batch.run(maxCycles - cycles); //último quadro, incompleto
+        } else {
+            done = batch.runFrame();
+        }
+        if (done == 0) {
+            break;
+        }
+        cycles += done;
+        frames++;
+    }
+
+    bool failed = false;
+    for (int l = 0; l < lanes; l++) {
+        const Chip8& c = batch.lane(l);
+        printf("lane %d\tseed %u\t%s\tdisplay %.16llx\n", l, seed + l, statusNames[c.status],
+               (unsigned long long) c.displayHash());
+        failed |= (c.status == Chip8::CRASHED);
+    }
+    printf("frames:  %lu\n", frames);
+    printf("cycles:  %lu\n", cycles);
+    printf("uniform: %llu\n", batch.uniformSteps);
+    printf("scalar:  %llu\n", batch.scalarSteps);
+
+    //repete cada lane sozinha e compara com o resultado do lote
+    if (verify) {
+        int mismatches = 0;
+        for (int l = 0; l < lanes; l++) {
+            Chip8* single = new Chip8(chip8);
+            single->seed = seed + l;
+            memset(single->key, 0, sizeof(single->key));
+
+            KeyScript again;
+            if (keysFile != NULL) {
+                again.load(keysFile);
+            }
+            unsigned long singleFrames;
+            runMachine(*single, again, frames, cycles, singleFrames);
+
+            if (!sameState(*single, batch.lane(l))) {
+                printf("lane %d differs from the interpreter\n", l);
+                mismatches++;
+            }
+            delete single;
+        }
+        printf("verify:  %s\n", mismatches == 0 ? "ok" : "FAILED");
+        failed |= (mismatches != 0);
+    }
+
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    //verificar se ROM foi passada como parâmetro
+    if (argc < 2) {
+        printf("ROM not specified!\n");
+        exit(1);
+    }
+
+    if (strcmp(argv[1], "--farm") == 0) {
+        if (argc < 3) {
+            printf("Job list not specified!\n");
+            exit(1);
+        }
+        farmFile = argv[2];
+        parseOptions(argc, argv, 3);
+
+        //cada job roda em uma máquina própria, sem saída além da linha do job
+        const char* unsupported = NULL;
+        if (chip8.trace != NULL) {
+            unsupported = "--trace";
+        } else if (traceName != NULL || traceDisplay) {
+            unsupported = "--trace-file";
+        } else if (profileName != NULL) {
+            unsupported = "--profile";
+        } else if (stateName != NULL) {
+            unsupported = "--save-state";
+        } else if (dump) {
+            unsupported = "--dump";
+        } else if (lanes > 0) {
+            unsupported = "--lanes";
+        } else if (verify) {
+            unsupported = "--verify";
+        }
+        if (unsupported != NULL) {
+            printf("Option not supported with --farm: %s\n", unsupported);
+            exit(1);
+        }
+        return runFarm();
+    }
+
+    parseOptions(argc, argv, 2);
+    chip8.seed = seed;
+
+    //carrega a ROM na memória (ou restaura o snapshot)
+    if (!loadProgram(chip8, argv[1])) {
+        exit(1);
+    }
+
+    KeyScript keys;
+    if (keysFile != NULL && !keys.load(keysFile)) {
+        exit(1);
+    }
+
+    //um movie traz a semente e o clock da sessão gravada, e a sua duração
+    keys.setup(chip8);
+    seed = chip8.seed;
+    if (keys.frames != 0 && !framesSet) {
+        maxFrames = keys.frames;
+    }
+
+    if (lanes > 0) {
+        return runBatch(keys);
+    }
+
+    if (traceName != NULL) {
+        if (!traceFile.open(traceName, chip8, traceDisplay)) {
+            exit(1);
+        }
+        chip8.traceFile = &traceFile;
+    }
+
+    if (profileName != NULL) {
+        chip8.profile = &profiler;
+    }
+
+    if (chip8.trace != NULL) {
+        printHeader(); //exibi um header dos registradores
+    }
+
+    //com --verify, a mesma máquina sem pular laços ociosos serve de referência
+    Chip8* reference = NULL;
+    if (verify) {
+        reference = new Chip8(chip8);
+        reference->trace = NULL;
+        reference->traceFile = NULL;
+        reference->profile = NULL;
+        reference->idleSkip = false;
+    }
+
+    //executa quadro a quadro até atingir um dos limites ou a ROM terminar
+    unsigned long frames;
+    Tone tone(0); //backend nulo: apenas conta o tempo de som
+    unsigned long cycles = runMachine(chip8, keys, maxFrames, maxCycles, frames, &tone);
+
+    if (chip8.traceFile != NULL) {
+        traceFile.close(chip8);
+    }
+
+    if (profileName != NULL && !writeProfile(argv[1])) {
+        exit(1);
+    }
+
+    if (stateName != NULL && !chip8.saveState(stateName)) {
+        exit(1);
+    }
+
+    if (chip8.status == Chip8::CRASHED) {
+        printf("Instruction %.4x couldn't be interpreted! Aborting emulation...\n", chip8.badInstr);
+    }
+
+    //resultado
+    static const char* statusNames[] = {"running", "exited", "crashed"};
+    printf("frames:  %lu\n", frames);
+    printf("cycles:  %lu\n", cycles);
+    printf("status:  %s\n", statusNames[chip8.status]);
+    printf("display: %.16llx\n", (unsigned long long) chip8.displayHash());
+    printf("sound:   %.2fs\n", (double) tone.toneTicks / TIMER_HZ);
+    printf("idle:    %llu cycles skipped\n", chip8.idleCycles);
+
+    //reprodução de um movie até o fim: a tela deve ser a mesma da gravação
+    bool replayFailed = false;
+    if (keys.frames != 0 && frames == keys.frames) {
+        replayFailed = (chip8.displayHash() != keys.hash);
+        if (replayFailed) {
+            printf("replay:  mismatch (recorded %.16llx)\n", (unsigned long long) keys.hash);
+        } else {
+            printf("replay:  ok\n");
+        }
+    }
+
+    bool verifyFailed = false;
+    if (reference != NULL) {
+        KeyScript again;
+        if (keysFile != NULL) {
+            again.load(keysFile);
+        }
+        unsigned long referenceFrames;
+        unsigned long referenceCycles = runMachine(*reference, again, maxFrames, maxCycles, referenceFrames);
+
+        verifyFailed = (referenceFrames != frames || referenceCycles != cycles || !sameState(*reference, chip8));
+        if (verifyFailed) {
+            printf("verify:  FAILED (without idle skip: %lu frames, %lu cycles)\n", referenceFrames, referenceCycles);
+        } else {
+            printf("verify:  ok\n");
+        }
+        delete reference;
+    }
+
+    if (dump) {
+        printf("\n");
+        printHeader();
+        printf("$%.4x", chip8.PC);
+        chip8.printState();
+        printf("\n");
+        printDisplay();
+    }
+
+    return (chip8.status == Chip8::CRASHED || replayFailed || verifyFailed) ? 1 : 0;
+}
@@ -0,0 +1,371 @@
+/****************************************************************************
+  JIT x86-64 do emulador Chip-8 (motor ENGINE_JIT).
+
+  Blocos básicos (sequências de instruções sem desvio) são traduzidos para
+  código nativo e guardados em um cache executável. Um bloco termina em um
+  desvio (JP, CALL, RET, JP V0), em um skip, em DRW ou em uma escrita na
+  memória (LD B, Vx e LD [I], Vx), que podem alterar o próprio código.
+
+  As instruções simples de registradores (LD, ADD, OR, AND, XOR, LD I, ADD I)
+  viram código nativo; as demais chamam diretamente o handler do interpretador.
+  LD Vx, K, EXIT e opcodes inválidos não são compiladas: o interpretador as
+  executa, uma de cada vez. Os timers são contados pelo escalonador (run()),
+  nunca no meio de um trecho, então as instruções de timer são compiladas.
+
+  O cache executável nunca é gravável e executável ao mesmo tempo (W^X): ele
+  fica só para leitura e execução, e volta a aceitar escrita apenas enquanto
+  um bloco é compilado. No macOS é mapeado com MAP_JIT.
+
+  Incluído no fim de chip8.h; em outras plataformas o motor usa o interpretador.
+*****************************************************************************/
+
+#ifndef CHIP8_JIT_H
+#define CHIP8_JIT_H
+
+#include <stddef.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#if defined(__APPLE__) && defined(MAP_JIT)
+#define CHIP8_JIT_MAP (MAP_PRIVATE | MAP_ANON | MAP_JIT)
+#else
+#define CHIP8_JIT_MAP (MAP_PRIVATE | MAP_ANON)
+#endif
+#endif
+
+/* Cache de blocos compilados de uma instância */
+class Jit {
+public:
+    //código gerado para um bloco: executa as primeiras count instruções do bloco
+    typedef void (*Block)(Chip8* c, int count);
+
+    static const int maxBlockLength = 32;          //instruções por bloco
+    static const size_t codeSize    = 256 * 1024;  //cache executável
+    static const int instrPoolSize  = 4096;        //instruções decodificadas usadas pelos blocos
+
+    bool ok;                                       //o cache executável foi alocado
+
+    Jit();
+    ~Jit();
+
+    int  run(Chip8& c, int cycles);
+    void invalidate(word addr);
+
+private:
+    //informações de um bloco, indexado pelo endereço inicial
+    struct BlockInfo {
+        Block entry;                               //NULL enquanto não compilado
+        byte  length;                              //instruções no bloco
+        bool  interpret;                           //a primeira instrução não é compilável
+    };
+
+    BlockInfo blocks[memSize];
+    byte      covered[memSize];                    //blocos compilados que contêm cada byte
+
+    byte*  code;
+    size_t used;
+    Instr  instrPool[instrPoolSize];
+    int    instrUsed;
+
+    //gerador de código
+    byte* out;
+    void emit8(byte b)  { *out++ = b; }
+    void emit16(word w) { memcpy(out, &w, 2); out += 2; }
+    void emit32(unsigned d) { memcpy(out, &d, 4); out += 4; }
+    void emit64(unsigned long long q) { memcpy(out, &q, 8); out += 8; }
+    void emitMem(byte op, byte reg, size_t offset); //op reg, [rbx+offset]
+    void emitCall(Handler handler, const Instr* in);
+    void emitSetPC(word value);
+    void emitEpilogue();
+
+    void flush();
+    bool protect(bool writable);
+    bool compile(const Chip8& c, word addr);
+};
+
+#if CHIP8_JIT_X64
+
+inline Jit::Jit() {
+    code = (byte*) mmap(NULL, codeSize, PROT_READ | PROT_WRITE, CHIP8_JIT_MAP, -1, 0);
+    ok = (code != MAP_FAILED);
+    if (!ok) {
+        code = NULL;
+    }
+    flush();
+    ok = ok && protect(false);
+}
+
+inline Jit::~Jit() {
+    if (code != NULL) {
+        munmap(code, codeSize);
+    }
+}
+
+/* Descarta todos os blocos compilados */
+inline void Jit::flush() {
+    memset(blocks, 0, sizeof(blocks));
+    memset(covered, 0, sizeof(covered));
+    used = 0;
+    instrUsed = 0;
+}
+
+/* Libera a escrita no cache executável (writable) ou volta a deixá-lo só executável */
+inline bool Jit::protect(bool writable) {
+    return mprotect(code, codeSize, writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC)) == 0;
+}
+
+/* Descarta os blocos que contêm o byte addr (a ROM escreveu sobre o próprio código) */
+inline void Jit::invalidate(word addr) {
+    addr &= memMask;
+
+    //a instrução que começa em addr ou addr-1 mudou: ela pode ter virado compilável
+    blocks[addr].interpret = false;
+    blocks[(addr - 1) & memMask].interpret = false;
+
+    if (covered[addr] == 0) {
+        return;
+    }
+
+    for (int back = 0; back < maxBlockLength * 2 && covered[addr] > 0; back++) {
+        word start = (addr - back) & memMask;
+        BlockInfo& b = blocks[start];
+        if (b.entry != NULL && back < b.length * 2) {
+            for (int i = 0; i < b.length * 2; i++) {
+                covered[(start + i) & memMask]--;
+            }
+            b.entry = NULL;
+            b.length = 0;
+        }
+    }
+}
+
+//op reg, [rbx+offset] (ModRM com base rbx e deslocamento de 32 bits)
+inline void Jit::emitMem(byte op, byte reg, size_t offset) {
+    emit8(op);
+    emit8(0x83 | (reg << 3));
+    emit32((unsigned) offset);
+}
+
+//handler(*c, *in), com c em rbx
+inline void Jit::emitCall(Handler handler, const Instr* in) {
+    emit8(0x48); emit8(0x89); emit8(0xDF);                                  //mov rdi, rbx
+    emit8(0x48); emit8(0xBE); emit64((unsigned long long) in);              //mov rsi, in
+    emit8(0x48); emit8(0xB8); emit64((unsigned long long) handler);         //mov rax, handler
+    emit8(0xFF); emit8(0xD0);                                               //call rax
+}
+
+//mov word [rbx+PC], value
+inline void Jit::emitSetPC(word value) {
+    emit8(0x66);
+    emitMem(0xC7, 0, offsetof(Chip8, PC));
+    emit16(value);
+}
+
+//add rsp, 8; pop r12; pop rbx; ret
+inline void Jit::emitEpilogue() {
+    emit8(0x48); emit8(0x83); emit8(0xC4); emit8(0x08);
+    emit8(0x41); emit8(0x5C);
+    emit8(0x5B);
+    emit8(0xC3);
+}
+
+/* Traduz o bloco que começa em addr; devolve false se o cache encheu */
+inline bool Jit::compile(const Chip8& c, word addr) {
+    //pior caso por instrução: 29 bytes (PC + chamada) e 20 da saída antecipada, mais prólogo e epílogo
+    if (used + maxBlockLength * 52 + 32 > codeSize || instrUsed + maxBlockLength > instrPoolSize) {
+        return false;
+    }
+
+    BlockInfo& block = blocks[addr];
+    byte* start = code + used;
+    out = start;
+
+    emit8(0x53);                                                            //push rbx
+    emit8(0x41); emit8(0x54);                                               //push r12
+    emit8(0x48); emit8(0x83); emit8(0xEC); emit8(0x08);                     //sub rsp, 8 (alinha a pilha)
+    emit8(0x48); emit8(0x89); emit8(0xFB);                                  //mov rbx, rdi
+    emit8(0x41); emit8(0x89); emit8(0xF4);                                  //mov r12d, esi
+
+    word pc = addr;
+    int length = 0;
+    bool terminated = false;
+
+    while (length < maxBlockLength && !terminated && pc + 1 <= memMask) {
+        word instr = ((c.memory[pc] << 8) | c.memory[pc + 1]);
+        byte op = opIndex(instr);
+        byte x  = ((instr & 0x0F00) >> 8);
+        byte y  = ((instr & 0x00F0) >> 4);
+        byte kk = (instr & 0x00FF);
+
+        //instruções que ficam com o interpretador encerram o bloco antes delas
+        if (op == OP_EXIT || op == OP_INVALID || op == OP_LD_VX_K) {
+            break;
+        }
+
+        switch (op) {
+            case OP_SYS: //ignorada
+                break;
+            case OP_LD_BYTE: //mov byte [V+x], kk
+                emitMem(0xC6, 0, offsetof(Chip8, V) + x);
+                emit8(kk);
+                break;
+            case OP_ADD_BYTE: //add byte [V+x], kk
+                emitMem(0x80, 0, offsetof(Chip8, V) + x);
+                emit8(kk);
+                break;
+            case OP_LD_REG: //mov al, [V+y]; mov [V+x], al
+                emitMem(0x8A, 0, offsetof(Chip8, V) + y);
+                emitMem(0x88, 0, offsetof(Chip8, V) + x);
+                break;
+            case OP_OR:  //mov al, [V+x]; or al, [V+y]; mov [V+x], al
+            case OP_AND:
+            case OP_XOR:
+                emitMem(0x8A, 0, offsetof(Chip8, V) + x);
+                emitMem(op == OP_OR ? 0x0A : (op == OP_AND ? 0x22 : 0x32), 0, offsetof(Chip8, V) + y);
+                emitMem(0x88, 0, offsetof(Chip8, V) + x);
+                break;
+            case OP_LD_I: //mov word [I], nnn
+                emit8(0x66);
+                emitMem(0xC7, 0, offsetof(Chip8, I));
+                emit16(instr & 0x0FFF);
+                break;
+            case OP_ADD_I: //movzx eax, byte [V+x]; add [I], ax
+                emit8(0x0F);
+                emitMem(0xB6, 0, offsetof(Chip8, V) + x);
+                emit8(0x66);
+                emitMem(0x01, 0, offsetof(Chip8, I));
+                break;
+            default: {
+                //as demais instruções chamam o handler do interpretador
+                Instr& in = instrPool[instrUsed++];
+                Chip8::decode(instr, in);
+
+                terminated = (op == OP_JP || op == OP_CALL || op == OP_RET || op == OP_JP_V0 ||
+                              op == OP_SE_BYTE || op == OP_SNE_BYTE || op == OP_SE_REG || op == OP_SNE_REG ||
+                              op == OP_SKP || op == OP_SKNP || op == OP_DRW || op == OP_LD_B || op == OP_LD_I_VX);
+                if (terminated) {
+                    emitSetPC(pc + 2); //o handler conta com o PC já atualizado
+                }
+                emitCall(in.exec, &in);
+                break;
+            }
+        }
+
+        pc += 2;
+        length++;
+
+        //saída antecipada quando o limite de instruções (count) acaba no meio do bloco
+        if (!terminated) {
+            emit8(0x41); emit8(0xFF); emit8(0xCC);                          //dec r12d
+            emit8(0x75); emit8(17);                                         //jnz próxima instrução
+            emitSetPC(pc);                                                  //9 bytes
+            emitEpilogue();                                                 //8 bytes
+        }
+    }
+
+    if (length == 0) {
+        block.interpret = true;
+        return true;
+    }
+
+    if (!terminated) {
+        emitSetPC(pc);
+    }
+    emitEpilogue();
+
+    used += out - start;
+    block.entry = (Block) start;
+    block.length = length;
+    for (int i = 0; i < length * 2; i++) {
+        covered[(addr + i) & memMask]++;
+    }
+    return true;
+}
+
+/* Executa até cycles instruções, usando os blocos compilados sempre que couberem no limite */
+inline int Jit::run(Chip8& c, int cycles) {
+    int done = 0;
+
+    while (done < cycles && c.status == Chip8::RUNNING) {
+        word pc = c.PC & memMask;
+        BlockInfo& block = blocks[pc];
+
+        if (block.entry == NULL && !block.interpret) {
+            //sem a troca de proteção, não há como compilar: o resto fica com o interpretador
+            if (!protect(true)) {
+                ok = false;
+                break;
+            }
+            if (!compile(c, pc)) {
+                flush();
+                compile(c, pc);
+            }
+            if (!protect(false)) {
+                ok = false;
+                break;
+            }
+        }
+
+        if (block.entry != NULL) {
+            int count = block.length;
+            if (count > cycles - done) {
+                count = cycles - done;
+            }
+
+            block.entry(&c, count);
+            done += count;
+        } else {
+            done += c.interpret(1);
+        }
+    }
+
+    return done;
+}
+
+#else
+
+inline Jit::Jit() {
+    ok = false;
+    code = NULL;
+}
+
+inline Jit::~Jit() {
+}
+
+inline void Jit::invalidate(word) {
+}
+
+inline int Jit::run(Chip8&, int) {
+    return 0;
+}
+
+#endif
+
+inline void JitRef::reset() {
+    delete ptr;
+    ptr = NULL;
+}
+
+inline JitRef::~JitRef() {
+    delete ptr;
+}
+
+inline void jitInvalidate(Jit* jit, word addr) {
+    jit->invalidate(addr);
+}
+
+/* Motor JIT: compila os blocos sob demanda; sem suporte a JIT, usa o interpretador */
+inline int Chip8::runJit(int cycles) {
+    if (jit.ptr == NULL) {
+        jit.ptr = new Jit();
+    }
+
+    if (jit.ptr->ok) {
+        return jit.ptr->run(*this, cycles);
+    }
+
+    return interpret(cycles);
+}
+
+#endif
@@ -0,0 +1,216 @@
+/****************************************************************************
+  Roteiro de teclas para execuções sem janela (headless).
+
+  Arquivo texto com um evento por linha, ordenado pelo número do quadro:
+      <quadro> down <tecla>    pressiona a tecla (0-f) no início do quadro
+      <quadro> up   <tecla>    solta a tecla no início do quadro
+  Linhas vazias ou iniciadas por '#' são ignoradas.
+
+  Exemplo (segura a tecla 5 por um segundo a partir do quadro 120):
+      120 down 5
+      180 up   5
+
+  MOVIE:
+  Um roteiro gravado pelo emulador com --record (KeyRecorder) é um "movie":
+  além dos eventos, traz a semente e o clock da máquina e, ao final, o número
+  de quadros e o hash da tela no último quadro, para conferir a reprodução:
+      seed   <semente>
+      clock  <instruções por segundo>
+      frames <quadros>
+      hash   <hash da tela, hexadecimal>
+  Reproduzido com o emulador headless (--keys), o movie roda sem esperar entre
+  os quadros e termina com o mesmo estado da sessão gravada.
+*****************************************************************************/
+
+#ifndef CHIP8_KEYSCRIPT_H
+#define CHIP8_KEYSCRIPT_H
+
+#include <ctype.h>
+#include <vector>
+#include "chip8.h"
+
+//um evento de teclado
+struct KeyEvent {
+    unsigned frame;   //quadro em que o evento acontece
+    byte     key;     //tecla do chip8 (0x0-0xF)
+    bool     down;    //pressionada (true) ou solta (false)
+};
+
+class KeyScript {
+public:
+    //dados de um movie (0 nos roteiros escritos à mão)
+    bool          hasSeed, hasClock;
+    unsigned      seed, clockHz;
+    unsigned long frames;         //quadros gravados
+    uint64_t      hash;           //displayHash() ao final da gravação (válido se frames != 0)
+
+    KeyScript() : hasSeed(false), hasClock(false), seed(0), clockHz(0), frames(0), hash(0), next(0) {}
+
+    bool load(const char* filename);
+    void add(unsigned frame, byte key, bool down);
+    void setup(Chip8& c) const;
+    void apply(Chip8& c, unsigned frame);
+    bool finished() const { return next >= events.size(); }
+
+private:
+    std::vector<KeyEvent> events;
+    size_t next;                  //próximo evento a ser aplicado
+};
+
+/* Lê o roteiro de um arquivo; em caso de erro imprime a linha problemática */
+inline bool KeyScript::load(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        printf("Couldn't open key script: %s\n", filename);
+        return false;
+    }
+
+    char line[128];
+    int  number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+
+        char* p = line;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (*p == '#' || *p == '\n' || *p == '\r' || *p == '\0') {
+            continue;
+        }
+
+        //cabeçalho e rodapé de um movie
+        char name[8];
+        unsigned long long value;
+        if (sscanf(p, "%7s", name) == 1 && isalpha((unsigned char) name[0])) {
+            bool ok = true;
+            if (strcmp(name, "seed") == 0) {
+                ok = sscanf(p, "%*s %llu", &value) == 1;
+                seed = value;
+                hasSeed = true;
+            } else if (strcmp(name, "clock") == 0) {
+                ok = sscanf(p, "%*s %llu", &value) == 1 && value > 0;
+                clockHz = value;
+                hasClock = true;
+            } else if (strcmp(name, "frames") == 0) {
+                ok = sscanf(p, "%*s %llu", &value) == 1;
+                frames = value;
+            } else if (strcmp(name, "hash") == 0) {
+                ok = sscanf(p, "%*s %llx", &value) == 1;
+                hash = value;
+            } else {
+                ok = false;
+            }
+
+            if (!ok) {
+                printf("Invalid key script line %d: %s", number, line);
+                fclose(file);
+                return false;
+            }
+            continue;
+        }
+
+        KeyEvent e;
+        char action[8];
+        unsigned k;
+        if (sscanf(p, "%u %7s %x", &e.frame, action, &k) != 3 || k > 0xF ||
+            (strcmp(action, "down") != 0 && strcmp(action, "up") != 0) ||
+            (!events.empty() && e.frame < events.back().frame)) {
+            printf("Invalid key script line %d: %s", number, line);
+            fclose(file);
+            return false;
+        }
+
+        e.key  = k;
+        e.down = (strcmp(action, "down") == 0);
+        events.push_back(e);
+    }
+
+    fclose(file);
+    next = 0;
+    return true;
+}
+
+/* Acrescenta um evento ao fim do roteiro (em ordem de quadro, como no arquivo) */
+inline void KeyScript::add(unsigned frame, byte key, bool down) {
+    KeyEvent e;
+    e.frame = frame;
+    e.key   = key & 0xF;
+    e.down  = down;
+    events.push_back(e);
+}
+
+/* Configura a máquina com a semente e o clock do movie (se houver) */
+inline void KeyScript::setup(Chip8& c) const {
+    if (hasSeed) {
+        c.seed = seed;
+    }
+    if (hasClock) {
+        c.clockHz = clockHz;
+    }
+}
+
+/* Aplica ao teclado da máquina os eventos do quadro informado */
+inline void KeyScript::apply(Chip8& c, unsigned frame) {
+    while (next < events.size() && events[next].frame <= frame) {
+        c.key[events[next].key] = events[next].down;
+        next++;
+    }
+}
+
+/* Grava as mudanças do teclado de uma sessão em um movie */
+class KeyRecorder {
+public:
+    KeyRecorder() : file(NULL) {}
+    ~KeyRecorder() { if (file != NULL) fclose(file); }
+
+    bool open(const char* filename, const Chip8& c);
+    void record(const Chip8& c, unsigned long frame);
+    void close(const Chip8& c, unsigned long frames);
+    bool recording() const { return file != NULL; }
+
+private:
+    FILE* file;
+    byte  key[16];                //teclado no último quadro gravado
+};
+
+/* Cria o movie e grava a semente e o clock da máquina (já com a ROM carregada) */
+inline bool KeyRecorder::open(const char* filename, const Chip8& c) {
+    file = fopen(filename, "w");
+    if (file == NULL) {
+        printf("Couldn't create movie: %s\n", filename);
+        return false;
+    }
+
+    fprintf(file, "seed   %u\n", c.seed);
+    fprintf(file, "clock  %u\n", c.clockHz);
+    memset(key, 0, sizeof(key));
+    return true;
+}
+
+/* Grava as teclas que mudaram desde o último quadro; chamado antes de executar o quadro */
+inline void KeyRecorder::record(const Chip8& c, unsigned long frame) {
+    if (file == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < 16; i++) {
+        if (c.key[i] != key[i]) {
+            fprintf(file, "%lu %s %x\n", frame, c.key[i] ? "down" : "up", i);
+            key[i] = c.key[i];
+        }
+    }
+}
+
+/* Termina o movie com o número de quadros e o hash da tela */
+inline void KeyRecorder::close(const Chip8& c, unsigned long frames) {
+    if (file == NULL) {
+        return;
+    }
+
+    fprintf(file, "frames %lu\n", frames);
+    fprintf(file, "hash   %.16llx\n", (unsigned long long) c.displayHash());
+    fclose(file);
+    file = NULL;
+}
+
+#endif
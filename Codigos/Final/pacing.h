@@ -0,0 +1,164 @@
+/****************************************************************************
+  Ritmo dos quadros (frame pacing) do frontend do emulador Chip-8.
+
+  FramePacer dá o ritmo da thread de emulação: dorme até pouco antes do prazo
+  do próximo quadro (o prazo menos o tempo que um quadro costuma levar entre
+  a leitura do teclado e a publicação, com 1ms de folga), lê o teclado o mais
+  tarde possível e executa o quadro. Os prazos são múltiplos de 1/60s a partir
+  do primeiro quadro, então atrasos isolados não acumulam.
+
+  FrameStats mede, na thread que desenha:
+  - o tempo entre a leitura do teclado usada no quadro e a sua apresentação (a
+    parte da latência entre a tecla e a tela que cabe à thread de emulação);
+  - nos quadros que aplicaram uma tecla nova, o tempo entre o evento da tecla,
+    quando a thread principal o tirou da fila da janela, e a apresentação. Isso
+    inclui a espera do evento até a leitura do teclado pela emulação, mas não o
+    tempo que ele passou na fila do sistema enquanto a thread principal estava
+    bloqueada (com vsync, até um quadro em window.display()); o monitor ainda
+    acrescenta a varredura da tela;
+  - o intervalo entre apresentações e a sua variação (jitter).
+*****************************************************************************/
+
+#ifndef CHIP8_PACING_H
+#define CHIP8_PACING_H
+
+#include <math.h>
+#include <stdio.h>
+#include <chrono>
+#include <thread>
+
+typedef std::chrono::steady_clock PaceClock;
+
+/* Duração em milissegundos */
+inline double milliseconds(PaceClock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+class FramePacer {
+public:
+    explicit FramePacer(double hz);
+
+    void wait();                  //dorme até o momento de ler o teclado
+    PaceClock::time_point inputSampled();  //o teclado acabou de ser lido
+    void finished();              //o quadro acabou de ser publicado
+
+private:
+    PaceClock::duration   period;
+    PaceClock::time_point deadline;   //quando o próximo quadro deve estar pronto
+    PaceClock::time_point input;      //leitura do teclado do quadro atual
+    bool                  started;
+    double                work;       //média móvel do tempo entre a leitura e a publicação (ms)
+};
+
+class FrameStats {
+public:
+    FrameStats() : started(false) {}
+
+    void presented(PaceClock::time_point input);  //apresentou um quadro cuja entrada foi lida em input
+    void keyPresented(PaceClock::time_point event); //o quadro apresentado aplicou uma tecla recebida em event
+    void print(FILE* out) const;
+
+private:
+    //média, desvio padrão e máximo de uma série de medidas (em ms)
+    struct Series {
+        unsigned long count;
+        double sum, squares, max;
+
+        Series() : count(0), sum(0), squares(0), max(0) {}
+        void   add(double value);
+        double mean() const { return count ? sum / count : 0; }
+        double deviation() const;
+    };
+
+    PaceClock::time_point last;       //apresentação anterior
+    bool                  started;
+    Series                latency;    //leitura do teclado -> apresentação
+    Series                keyLatency; //evento de tecla -> apresentação
+    Series                interval;   //apresentação -> apresentação
+};
+
+inline FramePacer::FramePacer(double hz)
+    : period(std::chrono::duration_cast<PaceClock::duration>(std::chrono::duration<double>(1.0 / hz))),
+      started(false), work(1.0) {
+}
+
+/* Dorme até o prazo do quadro menos o tempo estimado de trabalho (com 1ms de folga) */
+inline void FramePacer::wait() {
+    if (!started) {
+        return; //o primeiro quadro não tem prazo
+    }
+
+    std::chrono::duration<double, std::milli> margin(work + 1.0);
+    PaceClock::time_point wake = deadline - std::chrono::duration_cast<PaceClock::duration>(margin);
+    if (wake > PaceClock::now()) {
+        std::this_thread::sleep_until(wake);
+    }
+}
+
+inline PaceClock::time_point FramePacer::inputSampled() {
+    input = PaceClock::now();
+    return input;
+}
+
+/* Registra o fim do quadro e calcula o prazo do próximo */
+inline void FramePacer::finished() {
+    PaceClock::time_point now = PaceClock::now();
+    work = 0.9 * work + 0.1 * milliseconds(now - input);
+
+    if (started) {
+        deadline += period;
+        if (now > deadline + period) {
+            deadline = now + period; //atrasou mais de um quadro: recomeça a contagem
+        }
+    } else {
+        deadline = now + period;
+        started = true;
+    }
+}
+
+inline void FrameStats::Series::add(double value) {
+    count++;
+    sum += value;
+    squares += value * value;
+    if (value > max) {
+        max = value;
+    }
+}
+
+inline double FrameStats::Series::deviation() const {
+    if (count < 2) {
+        return 0;
+    }
+    double m = mean();
+    double variance = squares / count - m * m;
+    return variance > 0 ? sqrt(variance) : 0;
+}
+
+/* Registra a apresentação de um quadro */
+inline void FrameStats::presented(PaceClock::time_point input) {
+    PaceClock::time_point now = PaceClock::now();
+
+    latency.add(milliseconds(now - input));
+    if (started) {
+        interval.add(milliseconds(now - last));
+    }
+    started = true;
+    last = now;
+}
+
+/* Registra a apresentação de um quadro que aplicou uma tecla nova; chamado após presented() */
+inline void FrameStats::keyPresented(PaceClock::time_point event) {
+    keyLatency.add(milliseconds(last - event));
+}
+
+/* Imprime as estatísticas */
+inline void FrameStats::print(FILE* out) const {
+    fprintf(out, "frames:          %lu\n", latency.count);
+    fprintf(out, "input->present:  avg %.2f ms, max %.2f ms\n", latency.mean(), latency.max);
+    fprintf(out, "key->present:    avg %.2f ms, max %.2f ms (%lu key events)\n",
+            keyLatency.mean(), keyLatency.max, keyLatency.count);
+    fprintf(out, "frame time:      avg %.2f ms, jitter %.2f ms, max %.2f ms\n",
+            interval.mean(), interval.deviation(), interval.max);
+}
+
+#endif
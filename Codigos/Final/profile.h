@@ -0,0 +1,280 @@
+/****************************************************************************
+  Profiler do emulador Chip-8.
+
+  Profiler é mais uma política de rastreamento do interpretador (trace.h): com
+  Chip8::profile apontando para ele, cada instrução passa por record() antes de
+  ser executada. Ele conta, por Op e por endereço (PC):
+  - quantas vezes a instrução foi executada;
+  - o tempo do host gasto nela, do fim de um record() ao início do seguinte
+    (o contador de ciclos da CPU, convertido para nanossegundos no relatório).
+  Também acompanha a pilha de chamadas da ROM (CALL/RET, conferidos com SP e
+  stack[]) em uma árvore, uma folha por pilha distinta, com o tempo próprio de
+  cada uma. writeFolded() grava essa árvore como "folded stacks", uma linha por
+  pilha, no formato lido pelo flamegraph.pl e pelo speedscope:
+      PONG;sub_2f6;sub_31a 12345
+  Se o profiler começa com chamadas já em andamento (SP > 0, por exemplo após
+  um snapshot), as funções ainda não vistas aparecem como ret_XXX, pelo
+  endereço de retorno guardado em stack[].
+
+  Com Chip8::profile NULL (o padrão), os motores continuam usando NoTrace e o
+  profiler não custa nada além de um teste por trecho de run(). Enquanto ele
+  está ligado, a máquina roda no interpretador e não pula laços ociosos.
+
+  Incluído por chip8.h logo após trace.h.
+*****************************************************************************/
+
+#ifndef CHIP8_PROFILE_H
+#define CHIP8_PROFILE_H
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/* Relógio do profiler: o contador de ciclos da CPU onde houver, senão nanossegundos */
+inline uint64_t profileTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class Profiler {
+public:
+    static const bool enabled = true;
+
+    Profiler();
+
+    void record(const Chip8& c, word instr);
+    void pause();
+
+    void print(FILE* out, int top = 10) const;
+    void writeFolded(FILE* out, const char* root) const;
+
+private:
+    static const int unknownCaller = 0x8000;  //marca de função conhecida só pelo endereço de retorno
+
+    //uma pilha de chamadas: o nó raiz é o programa principal
+    struct Node {
+        int                 parent;
+        int                 function;   //endereço da função (ou unknownCaller | retorno)
+        int                 depth;      //SP dentro desta função
+        unsigned long long  count;
+        uint64_t            ticks;
+        std::map<int, int>  children;   //função chamada -> nó
+    };
+
+    unsigned long long opCount[OP_COUNT];
+    uint64_t           opTicks[OP_COUNT];
+    unsigned long long pcCount[memSize];
+    uint64_t           pcTicks[memSize];
+    word               pcInstr[memSize];  //última instrução executada em cada endereço
+    std::vector<Node>  nodes;
+    int                node;            //pilha da instrução atual
+
+    bool               started;         //há uma instrução anterior
+    bool               timing;          //o tempo da instrução anterior ainda está correndo
+    byte               lastOp;
+    word               lastPC;
+    uint64_t           last;            //fim do último record()
+
+    //calibração do relógio
+    uint64_t                              startTicks;
+    std::chrono::steady_clock::time_point startTime;
+
+    int    child(int parent, int function);
+    int    rebuild(const Chip8& c);
+    double nanoseconds(uint64_t ticks) const;
+    std::string stackName(int n, const char* root) const;
+};
+
+inline Profiler::Profiler() {
+    memset(opCount, 0, sizeof(opCount));
+    memset(opTicks, 0, sizeof(opTicks));
+    memset(pcCount, 0, sizeof(pcCount));
+    memset(pcTicks, 0, sizeof(pcTicks));
+    memset(pcInstr, 0, sizeof(pcInstr));
+
+    Node root;
+    root.parent = -1;
+    root.function = 0;
+    root.depth = 0;
+    root.count = 0;
+    root.ticks = 0;
+    nodes.push_back(root);
+    node = 0;
+
+    started = false;
+    timing = false;
+    lastOp = OP_INVALID;
+    lastPC = 0;
+    last = 0;
+
+    startTicks = profileTicks();
+    startTime = std::chrono::steady_clock::now();
+}
+
+/* Conta a instrução prestes a ser executada e atribui à anterior o tempo desde o fim dela */
+inline void Profiler::record(const Chip8& c, word instr) {
+    if (timing) {
+        uint64_t elapsed = profileTicks() - last;
+        opTicks[lastOp] += elapsed;
+        pcTicks[lastPC] += elapsed;
+        nodes[node].ticks += elapsed;
+    }
+
+    //a instrução anterior pode ter entrado ou saído de uma função
+    if (started && lastOp == OP_CALL) {
+        node = child(node, c.PC & memMask);
+    } else if (started && lastOp == OP_RET && nodes[node].parent >= 0) {
+        node = nodes[node].parent;
+    }
+    if (nodes[node].depth != c.SP) {
+        node = rebuild(c);
+    }
+
+    byte op = opIndex(instr);
+    word pc = c.PC & memMask;
+    opCount[op]++;
+    pcCount[pc]++;
+    pcInstr[pc] = instr;
+    nodes[node].count++;
+
+    lastOp = op;
+    lastPC = pc;
+    started = true;
+    timing = true;
+    last = profileTicks(); //o tempo do próprio profiler fica de fora
+}
+
+/* Para o relógio da última instrução (fim de um trecho de run(): o frontend não é contado) */
+inline void Profiler::pause() {
+    if (timing) {
+        uint64_t elapsed = profileTicks() - last;
+        opTicks[lastOp] += elapsed;
+        pcTicks[lastPC] += elapsed;
+        nodes[node].ticks += elapsed;
+        timing = false;
+    }
+}
+
+/* Nó da função chamada a partir de parent, criado na primeira chamada */
+inline int Profiler::child(int parent, int function) {
+    std::map<int, int>::const_iterator it = nodes[parent].children.find(function);
+    if (it != nodes[parent].children.end()) {
+        return it->second;
+    }
+
+    Node n;
+    n.parent = parent;
+    n.function = function;
+    n.depth = (nodes[parent].depth + 1) & (stackLevels - 1);
+    n.count = 0;
+    n.ticks = 0;
+    nodes.push_back(n);
+
+    int index = (int) nodes.size() - 1;
+    nodes[parent].children[function] = index;
+    return index;
+}
+
+/* Refaz a pilha a partir de stack[] e SP, quando ela não confere com a acompanhada */
+inline int Profiler::rebuild(const Chip8& c) {
+    int n = 0;
+    for (int i = 0; i < c.SP; i++) {
+        n = child(n, unknownCaller | (c.stack[i] & memMask));
+    }
+    return n;
+}
+
+/* Converte ticks do relógio do profiler em nanossegundos */
+inline double Profiler::nanoseconds(uint64_t ticks) const {
+    uint64_t elapsed = profileTicks() - startTicks;
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - startTime).count();
+    return (elapsed > 0) ? ticks * (ns / elapsed) : 0;
+}
+
+/* Nome da pilha do nó n, da raiz até ele, separado por ';' */
+inline std::string Profiler::stackName(int n, const char* root) const {
+    std::vector<int> path;
+    for (; n > 0; n = nodes[n].parent) {
+        path.push_back(n);
+    }
+
+    std::string name = root;
+    char frame[16];
+    for (size_t i = path.size(); i-- > 0; ) {
+        int function = nodes[path[i]].function;
+        if (function & unknownCaller) {
+            snprintf(frame, sizeof(frame), ";ret_%.3x", function & memMask);
+        } else {
+            snprintf(frame, sizeof(frame), ";sub_%.3x", function);
+        }
+        name += frame;
+    }
+    return name;
+}
+
+/* Imprime o tempo por Op e os endereços mais quentes */
+inline void Profiler::print(FILE* out, int top) const {
+    unsigned long long count = 0;
+    uint64_t ticks = 0;
+    for (int op = 0; op < OP_COUNT; op++) {
+        count += opCount[op];
+        ticks += opTicks[op];
+    }
+    if (count == 0) {
+        fprintf(out, "profile: no instructions executed\n");
+        return;
+    }
+
+    double total = nanoseconds(ticks);
+    fprintf(out, "profile: %llu instructions, %.3f ms\n", count, total / 1e6);
+    fprintf(out, "%-10s %12s %7s %12s %9s\n", "op", "count", "time%", "ns", "ns/instr");
+    for (int op = 0; op < OP_COUNT; op++) {
+        if (opCount[op] != 0) {
+            double ns = nanoseconds(opTicks[op]);
+            fprintf(out, "%-10s %12llu %6.1f%% %12.0f %9.2f\n", opNames[op], opCount[op],
+                    total > 0 ? 100 * ns / total : 0, ns, ns / opCount[op]);
+        }
+    }
+
+    //os top endereços com mais tempo
+    fprintf(out, "\n%-6s %-20s %12s %7s %12s\n", "pc", "instruction", "count", "time%", "ns");
+    std::vector<bool> shown(memSize, false);
+    for (int i = 0; i < top; i++) {
+        int best = -1;
+        for (int pc = 0; pc < memSize; pc++) {
+            if (!shown[pc] && pcCount[pc] != 0 && (best < 0 || pcTicks[pc] > pcTicks[best])) {
+                best = pc;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        shown[best] = true;
+
+        char text[32];
+        disassemble(pcInstr[best], text, sizeof(text));
+        double ns = nanoseconds(pcTicks[best]);
+        fprintf(out, "$%.4x  %-20s %12llu %6.1f%% %12.0f\n", best, text, pcCount[best],
+                total > 0 ? 100 * ns / total : 0, ns);
+    }
+}
+
+/* Grava as pilhas em "folded stacks", com o tempo próprio de cada uma em nanossegundos */
+inline void Profiler::writeFolded(FILE* out, const char* root) const {
+    for (size_t n = 0; n < nodes.size(); n++) {
+        unsigned long long ns = (unsigned long long) (nanoseconds(nodes[n].ticks) + 0.5);
+        if (ns > 0) {
+            fprintf(out, "%s %llu\n", stackName(n, root).c_str(), ns);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+/****************************************************************************
+  Rewind (voltar no tempo) do emulador Chip-8.
+
+  Ao fim de cada quadro o frontend chama push(), que guarda o estado da máquina
+  (o mesmo bloco de snapshot.h) em um buffer circular de tamanho fixo; rewind()
+  volta um quadro. Para caber muitos minutos na memória, só um quadro a cada
+  keyInterval (keyframe) é guardado inteiro; os demais guardam apenas a
+  diferença para o último keyframe: o XOR dos dois estados, codificado em
+  trechos iguais (pulados) e trechos diferentes (copiados):
+      [iguais: 2 bytes] [diferentes: 2 bytes] [XOR dos bytes diferentes] ...
+  Em um quadro típico só mudam os registradores, os timers, algumas linhas da
+  tela e poucos bytes de memória, e a diferença ocupa dezenas de bytes.
+
+  Quando o buffer enche, ou quando o limite de quadros é atingido, o grupo mais
+  antigo (um keyframe e as diferenças que dependem dele) é descartado.
+*****************************************************************************/
+
+#ifndef CHIP8_REWIND_H
+#define CHIP8_REWIND_H
+
+#include <deque>
+#include <vector>
+#include "chip8.h"
+
+class Rewind {
+public:
+    static const int keyInterval = 60;    //um keyframe por segundo de tempo emulado
+
+    //frames: quadros guardados no máximo; bytes: tamanho do buffer circular
+    Rewind(int frames, size_t bytes);
+
+    void push(const Chip8& c);
+    bool rewind(Chip8& c);
+    void clear();
+
+    int    frames() const { return (int) entries.size(); }
+    size_t used() const;
+
+private:
+    struct Entry {
+        size_t offset;                    //posição no buffer circular
+        size_t size;
+        bool   keyframe;
+    };
+
+    int               maxFrames;
+    std::vector<byte> ring;
+    size_t            head;               //onde o próximo quadro será gravado
+    std::deque<Entry> entries;            //do mais antigo para o mais recente
+    int               sinceKey;           //quadros desde o último keyframe
+    byte              key[snapshotSize];  //cópia do último keyframe
+    byte              state[snapshotSize];
+    byte              delta[snapshotSize * 3];
+
+    bool   alloc(size_t size, size_t& offset);
+    void   dropOldest();
+    void   store(const byte* data, size_t size, bool keyframe);
+    size_t encode(const byte* now, const byte* base, byte* out) const;
+    void   decode(const byte* in, size_t size, byte* out) const;
+};
+
+inline Rewind::Rewind(int frames, size_t bytes) : maxFrames(frames), ring(bytes) {
+    clear();
+}
+
+/* Esquece todos os quadros guardados */
+inline void Rewind::clear() {
+    entries.clear();
+    head = 0;
+    sinceKey = keyInterval;
+}
+
+/* Bytes do buffer ocupados pelos quadros guardados */
+inline size_t Rewind::used() const {
+    size_t total = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        total += entries[i].size;
+    }
+    return total;
+}
+
+/* Guarda o estado da máquina ao fim de um quadro */
+inline void Rewind::push(const Chip8& c) {
+    c.snapshot(state, sizeof(state));
+
+    if (sinceKey < keyInterval && !entries.empty()) {
+        size_t size = encode(state, key, delta);
+        if (size < snapshotSize) {
+            store(delta, size, false);
+            sinceKey++;
+
+            //o grupo do keyframe pode ter sido descartado para dar lugar à diferença
+            if (!entries.empty() && !entries.front().keyframe) {
+                clear();
+            } else {
+                return;
+            }
+        }
+    }
+
+    memcpy(key, state, sizeof(key));
+    store(state, sizeof(state), true);
+    sinceKey = 1;
+}
+
+/* Volta um quadro: descarta o mais recente e restaura o anterior */
+inline bool Rewind::rewind(Chip8& c) {
+    if (entries.size() < 2) {
+        return false;
+    }
+    entries.pop_back();
+    head = entries.back().offset + entries.back().size;
+
+    //o estado é o keyframe do grupo mais a diferença (se houver)
+    size_t last = entries.size() - 1, k = last;
+    while (!entries[k].keyframe) {
+        k--;
+    }
+    memcpy(state, &ring[entries[k].offset], snapshotSize);
+    if (k != last) {
+        decode(&ring[entries[last].offset], entries[last].size, state);
+    }
+
+    //ao continuar, o próximo quadro começa um grupo novo
+    sinceKey = keyInterval;
+    return c.restore(state, sizeof(state));
+}
+
+/* Grava um quadro no buffer circular, descartando os grupos mais antigos se preciso */
+inline void Rewind::store(const byte* data, size_t size, bool keyframe) {
+    if ((int) entries.size() >= maxFrames && !entries.empty()) {
+        dropOldest();
+    }
+
+    size_t offset;
+    if (!alloc(size, offset)) {
+        return;
+    }
+
+    memcpy(&ring[offset], data, size);
+    head = offset + size;
+
+    Entry entry = {offset, size, keyframe};
+    entries.push_back(entry);
+}
+
+/*  Encontra espaço contínuo para size bytes a partir de head (ou do início do buffer,
+ *  se não couber até o fim), descartando os grupos mais antigos até caber.
+ */
+inline bool Rewind::alloc(size_t size, size_t& offset) {
+    if (size > ring.size()) {
+        return false;
+    }
+
+    for (;;) {
+        if (entries.empty()) {
+            offset = 0;
+            return true;
+        }
+
+        size_t start = entries.front().offset;
+        if (start < head) {
+            //ocupado: [start, head); livre: [head, fim) e [0, start)
+            if (head + size <= ring.size()) {
+                offset = head;
+                return true;
+            }
+            if (size <= start) {
+                offset = 0;
+                return true;
+            }
+        } else if (head + size <= start) {
+            //ocupado: [start, fim) e [0, head); livre: [head, start)
+            offset = head;
+            return true;
+        }
+
+        dropOldest();
+    }
+}
+
+/* Descarta o grupo mais antigo: o keyframe e as diferenças que dependem dele */
+inline void Rewind::dropOldest() {
+    do {
+        entries.pop_front();
+    } while (!entries.empty() && !entries.front().keyframe);
+}
+
+/* Codifica a diferença entre now e base; retorna o tamanho gravado em out */
+inline size_t Rewind::encode(const byte* now, const byte* base, byte* out) const {
+    size_t i = 0, o = 0;
+    while (i < snapshotSize) {
+        //trecho igual, comparado de 8 em 8 bytes enquanto possível
+        size_t same = i;
+        while (same + 8 <= snapshotSize && same - i + 8 <= 0xFFFF) {
+            uint64_t a, b;
+            memcpy(&a, now + same, 8);
+            memcpy(&b, base + same, 8);
+            if (a != b) {
+                break;
+            }
+            same += 8;
+        }
+        while (same < snapshotSize && same - i < 0xFFFF && now[same] == base[same]) {
+            same++;
+        }
+
+        size_t diff = same;
+        while (diff < snapshotSize && diff - same < 0xFFFF && now[diff] != base[diff]) {
+            diff++;
+        }
+
+        word equal = same - i, changed = diff - same;
+        out[o++] = equal & 0xFF;
+        out[o++] = equal >> 8;
+        out[o++] = changed & 0xFF;
+        out[o++] = changed >> 8;
+        for (size_t j = same; j < diff; j++) {
+            out[o++] = now[j] ^ base[j];
+        }
+        i = diff;
+    }
+    return o;
+}
+
+/* Aplica sobre out (que contém o keyframe) a diferença codificada por encode() */
+inline void Rewind::decode(const byte* in, size_t size, byte* out) const {
+    size_t i = 0, o = 0;
+    while (i + 4 <= size) {
+        o += in[i] | (in[i + 1] << 8);
+        size_t changed = in[i + 2] | (in[i + 3] << 8);
+        i += 4;
+        for (size_t j = 0; j < changed; j++) {
+            out[o++] ^= in[i++];
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,217 @@
+/****************************************************************************
+  Cache de ROMs do emulador Chip-8.
+
+  Cada ROM é lida uma única vez: o arquivo é mapeado na memória (mmap),
+  validado, identificado pelo hash do conteúdo e convertido em uma imagem da
+  memória da máquina (fontes + ROM, com as instruções já decodificadas). As
+  máquinas que carregam a ROM depois apenas copiam a imagem, o que compartilha
+  as páginas dela (copy-on-write, como em Memory): carregar a mesma ROM em
+  milhares de máquinas não lê o arquivo nem decodifica nada de novo.
+
+  Arquivos com o mesmo conteúdo (cópias da ROM com outros nomes) compartilham a
+  mesma imagem. Se o arquivo mudar no disco (tamanho, data ou inode), ele é lido
+  de novo na próxima carga.
+
+  preload() carrega de uma vez todas as ROMs de um diretório (por exemplo roms/).
+
+  Incluído no fim de chip8.h; Chip8::loadROM() usa o cache compartilhado.
+*****************************************************************************/
+
+#ifndef CHIP8_ROMCACHE_H
+#define CHIP8_ROMCACHE_H
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//uma ROM carregada
+struct RomImage {
+    uint64_t          hash;       //FNV-1a do conteúdo
+    std::vector<byte> data;       //conteúdo do arquivo
+    Memory            memory;     //memória da máquina com a ROM carregada
+};
+
+class RomCache {
+public:
+    static RomCache& shared();
+
+    const RomImage* load(const char* filename);
+    bool contains(const char* filename);
+    int  preload(const char* directory);
+    int  size();
+
+private:
+    //arquivo já lido: a imagem vale enquanto o arquivo não mudar
+    struct File {
+        dev_t           device;
+        ino_t           inode;
+        off_t           size;
+        time_t          modified;
+        const RomImage* image;
+    };
+
+    std::mutex                             lock;
+    std::map<std::string, File>            files;
+    std::multimap<uint64_t, RomImage*>     images;   //por hash do conteúdo
+
+    const RomImage* find(const std::string& name, const struct stat& info);
+    const RomImage* intern(const byte* data, size_t size);
+};
+
+/* Cache usado por Chip8::loadROM(), compartilhado pelo processo inteiro */
+inline RomCache& RomCache::shared() {
+    static RomCache cache;
+    return cache;
+}
+
+/* Imagem do arquivo, se ele já foi lido e não mudou desde então */
+inline const RomImage* RomCache::find(const std::string& name, const struct stat& info) {
+    std::map<std::string, File>::const_iterator it = files.find(name);
+    if (it == files.end()) {
+        return NULL;
+    }
+
+    const File& f = it->second;
+    if (f.device != info.st_dev || f.inode != info.st_ino || f.size != info.st_size || f.modified != info.st_mtime) {
+        return NULL;
+    }
+    return f.image;
+}
+
+/* Imagem com o conteúdo informado, criada se ainda não existir nenhuma igual */
+inline const RomImage* RomCache::intern(const byte* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+
+    typedef std::multimap<uint64_t, RomImage*>::const_iterator Iterator;
+    std::pair<Iterator, Iterator> same = images.equal_range(hash);
+    for (Iterator it = same.first; it != same.second; ++it) {
+        const std::vector<byte>& other = it->second->data;
+        if (other.size() == size && (size == 0 || memcmp(&other[0], data, size) == 0)) {
+            return it->second;
+        }
+    }
+
+    //a imagem nunca é liberada: as máquinas podem estar usando as páginas dela
+    RomImage* image = new RomImage;
+    image->hash = hash;
+    image->data.assign(data, data + size);
+    image->memory.load(0, fontset, sizeof(fontset));
+    image->memory.load(fontSize, data, size);
+    images.insert(std::make_pair(hash, image));
+    return image;
+}
+
+/* Lê a ROM (ou a encontra no cache); em caso de erro imprime a mensagem e retorna NULL */
+inline const RomImage* RomCache::load(const char* filename) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    int fd = open(filename, O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)) {
+        printf("Couldn't open ROM: %s\n", filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    const RomImage* image = find(filename, info);
+    if (image != NULL) {
+        close(fd);
+        return image;
+    }
+
+    if (info.st_size > (memSize - fontSize)) {
+        printf("ROM too big for Chip8 Memory (more than 3.5KB)!\n");
+        close(fd);
+        return NULL;
+    }
+
+    //o arquivo é mapeado apenas para ser copiado para a imagem
+    size_t size = info.st_size;
+    const byte* data = NULL;
+    if (size > 0) {
+        void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            printf("Couldn't open ROM: %s\n", filename);
+            close(fd);
+            return NULL;
+        }
+        data = (const byte*) map;
+    }
+
+    image = intern(data, size);
+    if (data != NULL) {
+        munmap((void*) data, size);
+    }
+    close(fd);
+
+    File f = {info.st_dev, info.st_ino, info.st_size, info.st_mtime, image};
+    files[filename] = f;
+    return image;
+}
+
+/* O arquivo já está no cache (e não mudou)? */
+inline bool RomCache::contains(const char* filename) {
+    std::lock_guard<std::mutex> guard(lock);
+
+    struct stat info;
+    return stat(filename, &info) == 0 && find(filename, info) != NULL;
+}
+
+/* Carrega todas as ROMs do diretório (exceto arquivos ocultos); retorna quantas, ou -1 */
+inline int RomCache::preload(const char* directory) {
+    DIR* dir = opendir(directory);
+    if (dir == NULL) {
+        printf("Couldn't open ROM directory: %s\n", directory);
+        return -1;
+    }
+
+    int count = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        std::string path = std::string(directory) + "/" + entry->d_name;
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode) && load(path.c_str()) != NULL) {
+            count++;
+        }
+    }
+
+    closedir(dir);
+    return count;
+}
+
+/* Número de imagens distintas no cache */
+inline int RomCache::size() {
+    std::lock_guard<std::mutex> guard(lock);
+    return (int) images.size();
+}
+
+/*  Carrega a ROM na memória. A memória passa a ser a imagem da ROM no cache
+ *  (fontes + ROM, o restante zerado), compartilhada com as outras máquinas.
+ */
+inline bool Chip8::loadROM(const char* filename) {
+    const RomImage* rom = RomCache::shared().load(filename);
+    if (rom == NULL) {
+        return false;
+    }
+
+    memory = rom->memory;
+    jit.reset();
+    return true;
+}
+
+#endif
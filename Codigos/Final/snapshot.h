@@ -0,0 +1,268 @@
+/****************************************************************************
+  Snapshot (save state) do emulador Chip-8.
+
+  snapshot() grava o estado completo da máquina (memória, registradores, pilha,
+  timers, tela, teclado e o estado do gerador de números aleatórios) em um bloco
+  binário de snapshotSize bytes, que pode ficar na memória ou ser gravado em
+  disco (saveState()); restore() e loadState() fazem o caminho inverso.
+
+  FORMATO:
+  Um cabeçalho (SnapshotHeader, 16 bytes) seguido dos campos da máquina, na
+  ordem de snapshot(), em little-endian. O checksum (Fletcher de 32 bits
+  sobre palavras de 16 bits) cobre os bytes após o cabeçalho; blocos com outra versão, outro tamanho ou
+  checksum errado são recusados.
+
+  A configuração da execução (motor, rastreamento) não faz parte do snapshot, e
+  o código do JIT é refeito sob demanda.
+
+  Os emuladores aceitam um snapshot no lugar da ROM (loadProgram()); nesse caso
+  a semente e o clock também vêm do snapshot.
+
+  Incluído no fim de chip8.h.
+*****************************************************************************/
+
+#ifndef CHIP8_SNAPSHOT_H
+#define CHIP8_SNAPSHOT_H
+
+const char snapshotMagic[4] = {'C', '8', 'S', 'S'};
+const word snapshotVersion  = 2;
+
+/* Cabeçalho do snapshot */
+struct SnapshotHeader {
+    char     magic[4];            //"C8SS"
+    word     version;
+    word     headerSize;          //sizeof(SnapshotHeader)
+    uint32_t payloadSize;         //bytes após o cabeçalho
+    uint32_t checksum;            //snapshotChecksum() dos bytes após o cabeçalho
+};
+
+//bytes após o cabeçalho
+const size_t snapshotPayload = 16 + 2 + 2 + 2 + 1 + 1 + 1 + 2 + 4 + 4 + 4  //V, I, PC, SP, timers, status, badInstr, seed, clock
+                             + stackLevels * 2 + 16                       //pilha e teclado
+                             + displayHeight * 8 + memSize;               //tela e memória
+
+//tamanho total de um snapshot
+const size_t snapshotSize = sizeof(SnapshotHeader) + snapshotPayload;
+
+/* Escrita e leitura sequencial dos campos, em little-endian */
+class SnapshotStream {
+public:
+    explicit SnapshotStream(byte* buffer) : data(buffer), pos(0) {}
+
+    void put(const void* src, size_t size) { memcpy(data + pos, src, size); pos += size; }
+    void get(void* dst, size_t size)       { memcpy(dst, data + pos, size); pos += size; }
+
+    void putInt(uint64_t value, int size) {
+        for (int i = 0; i < size; i++) {
+            data[pos++] = (value >> (8 * i)) & 0xFF;
+        }
+    }
+
+    uint64_t getInt(int size) {
+        uint64_t value = 0;
+        for (int i = 0; i < size; i++) {
+            value |= (uint64_t) data[pos++] << (8 * i);
+        }
+        return value;
+    }
+
+private:
+    byte*  data;
+    size_t pos;
+};
+
+/*  Fletcher-32 (palavras de 16 bits em little-endian). Rápido o bastante para ser
+ *  calculado a cada quadro (rewind.h), ao contrário de um hash byte a byte.
+ */
+inline uint32_t snapshotChecksum(const byte* data, size_t size) {
+    uint32_t sum1 = 0xFFFF, sum2 = 0xFFFF;
+    size_t words = size / 2;
+
+    while (words > 0) {
+        //até 359 palavras antes que as somas precisem ser reduzidas
+        size_t block = (words > 359) ? 359 : words;
+        words -= block;
+        for (size_t i = 0; i < block; i++) {
+            sum1 += data[0] | (data[1] << 8);
+            sum2 += sum1;
+            data += 2;
+        }
+        sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+        sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    }
+
+    if (size & 1) {
+        sum1 += data[0];
+        sum2 += sum1;
+        sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+        sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    }
+
+    sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+    sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+    return (sum2 << 16) | sum1;
+}
+
+/* Grava o estado da máquina em out, que deve ter snapshotSize bytes; retorna o tamanho gravado */
+inline size_t Chip8::snapshot(byte* out, size_t size) const {
+    if (size < snapshotSize) {
+        return 0;
+    }
+
+    SnapshotStream s(out + sizeof(SnapshotHeader));
+    s.put(V, sizeof(V));
+    s.putInt(I, 2);
+    s.putInt(PC, 2);
+    s.putInt(SP, 2);
+    s.putInt(delayTimer, 1);
+    s.putInt(soundTimer, 1);
+    s.putInt(status, 1);
+    s.putInt(badInstr, 2);
+    s.putInt(seed, 4);
+    s.putInt(clockHz, 4);
+    s.putInt(timerPhase, 4);
+    for (int i = 0; i < stackLevels; i++) {
+        s.putInt(stack[i], 2);
+    }
+    s.put(key, sizeof(key));
+    for (int i = 0; i < displayHeight; i++) {
+        s.putInt(display[i], 8);
+    }
+    byte data[memSize];
+    memory.copy(0, data, memSize);
+    s.put(data, memSize);
+
+    SnapshotHeader header;
+    memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+    header.version     = snapshotVersion;
+    header.headerSize  = sizeof(SnapshotHeader);
+    header.payloadSize = snapshotPayload;
+    header.checksum    = snapshotChecksum(out + sizeof(SnapshotHeader), snapshotPayload);
+    memcpy(out, &header, sizeof(header));
+
+    return snapshotSize;
+}
+
+/* Restaura o estado gravado por snapshot(); em caso de bloco inválido, a máquina não é alterada */
+inline bool Chip8::restore(const byte* in, size_t size) {
+    SnapshotHeader header;
+    if (size < sizeof(header)) {
+        return false;
+    }
+
+    memcpy(&header, in, sizeof(header));
+    if (memcmp(header.magic, snapshotMagic, sizeof(header.magic)) != 0 || header.version != snapshotVersion ||
+        header.headerSize != sizeof(SnapshotHeader) || header.payloadSize != snapshotPayload ||
+        size < snapshotSize || header.checksum != snapshotChecksum(in + sizeof(header), snapshotPayload)) {
+        return false;
+    }
+
+    //os registradores são lidos antes em variáveis locais: um bloco com checksum válido
+    //ainda pode trazer valores que a máquina não aceita (snapshots vêm de arquivos)
+    SnapshotStream s(const_cast<byte*>(in) + sizeof(header));
+    byte newV[16];
+    s.get(newV, sizeof(newV));
+    word     newI          = s.getInt(2);
+    word     newPC         = s.getInt(2);
+    word     newSP         = s.getInt(2);
+    byte     newDelayTimer = s.getInt(1);
+    byte     newSoundTimer = s.getInt(1);
+    byte     newStatus     = s.getInt(1);
+    word     newBadInstr   = s.getInt(2);
+    unsigned newSeed       = s.getInt(4);
+    unsigned newClockHz    = s.getInt(4);
+    unsigned newTimerPhase = s.getInt(4);
+    if (newClockHz == 0 || newTimerPhase >= newClockHz || newStatus > CRASHED || newSP >= stackLevels) {
+        return false;
+    }
+
+    memcpy(V, newV, sizeof(V));
+    I          = newI;
+    PC         = newPC;
+    SP         = newSP;
+    delayTimer = newDelayTimer;
+    soundTimer = newSoundTimer;
+    status     = newStatus;
+    badInstr   = newBadInstr;
+    seed       = newSeed;
+    clockHz    = newClockHz;
+    timerPhase = newTimerPhase;
+    for (int i = 0; i < stackLevels; i++) {
+        stack[i] = s.getInt(2);
+    }
+    s.get(key, sizeof(key));
+    for (int i = 0; i < displayHeight; i++) {
+        display[i] = s.getInt(8);
+    }
+    byte data[memSize];
+    s.get(data, memSize);
+    memory.load(0, data, memSize);
+
+    //a memória mudou: o código compilado é descartado
+    jit.reset();
+    beep  = false;
+    dirty = true;
+    return true;
+}
+
+/* Grava o snapshot em um arquivo */
+inline bool Chip8::saveState(const char* filename) const {
+    byte data[snapshotSize];
+    snapshot(data, sizeof(data));
+
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        printf("Couldn't create state file: %s\n", filename);
+        return false;
+    }
+
+    bool ok = fwrite(data, 1, sizeof(data), file) == sizeof(data);
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        printf("Couldn't write state file: %s\n", filename);
+    }
+    return ok;
+}
+
+/* Restaura o snapshot gravado em um arquivo */
+inline bool Chip8::loadState(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        printf("Couldn't open state file: %s\n", filename);
+        return false;
+    }
+
+    byte data[snapshotSize];
+    size_t size = fread(data, 1, sizeof(data), file);
+    fclose(file);
+
+    if (!restore(data, size)) {
+        printf("Invalid state file: %s\n", filename);
+        return false;
+    }
+    return true;
+}
+
+/* O arquivo é um snapshot (começa com "C8SS")? */
+inline bool isStateFile(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    char magic[4];
+    bool state = fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+                 memcmp(magic, snapshotMagic, sizeof(magic)) == 0;
+    fclose(file);
+    return state;
+}
+
+/* Carrega uma ROM ou, se o arquivo for um snapshot, restaura a máquina salva */
+inline bool loadProgram(Chip8& c, const char* filename) {
+    if (RomCache::shared().contains(filename)) {
+        return c.loadROM(filename);
+    }
+    return isStateFile(filename) ? c.loadState(filename) : c.loadROM(filename);
+}
+
+#endif
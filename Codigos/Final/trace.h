@@ -0,0 +1,523 @@
+/****************************************************************************
+  Rastreamento (trace) da execução do emulador Chip-8.
+
+  O interpretador recebe a política de rastreamento como parâmetro de template:
+  - NoTrace:     não gera nenhum código; é o que os motores usam normalmente.
+  - TraceBuffer: guarda cada instrução executada (e os registradores antes dela)
+                 em um buffer circular pré-alocado, sem formatar texto.
+  - TraceFile:   grava as instruções em um arquivo binário compacto, mapeado
+                 em memória (mmap), lido depois pela ferramenta c8trace.
+  A conversão para texto (flush) é feita fora do laço de emulação, por exemplo
+  uma vez a cada quadro, no mesmo formato de printHeader()/printState().
+
+  ARQUIVO BINÁRIO (.c8t):
+  Um cabeçalho (TraceFileHeader, 32 bytes) seguido de registros de 16 bytes.
+  Cada instrução ocupa um TraceFileRecord com PC, instrução, I e SP antes dela
+  e os registradores que ela alterou. Quando a instrução altera mais de um
+  registrador além do VF (LD Vx, [I]), ou a cada traceKeyframe instruções, um
+  registro de extensão com V0-VE completos vem logo em seguida; com a tela
+  habilitada, o XOR de cada linha alterada por CLS/DRW também vem em extensões.
+  Todo registro de extensão tem o bit TRACE_EXTENSION no byte de flags, que é
+  o primeiro byte de qualquer registro. Assim, a partir de qualquer posição
+  múltipla de 16 bytes, é possível achar a próxima instrução.
+
+  Incluído por chip8.h logo após a declaração da classe Chip8.
+*****************************************************************************/
+
+#ifndef CHIP8_TRACE_H
+#define CHIP8_TRACE_H
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Política sem rastreamento: o compilador elimina todas as chamadas */
+struct NoTrace {
+    static const bool enabled = false;
+    void record(const Chip8&, word) {}
+};
+
+/* Uma instrução executada e o estado dos registradores antes dela */
+struct TraceRecord {
+    word pc;
+    word instr;
+    word I;
+    byte SP;
+    byte reserved;
+    byte V[16];
+};
+
+/* Buffer circular de instruções executadas */
+class TraceBuffer {
+public:
+    static const bool enabled = true;
+
+    unsigned long long dropped;   //registros sobrescritos antes de serem formatados
+
+    explicit TraceBuffer(size_t capacity = 1 << 16);
+    ~TraceBuffer();
+
+    void record(const Chip8& c, word instr);
+    void flush(FILE* out);
+
+private:
+    TraceRecord*       records;
+    size_t             mask;      //capacidade - 1 (a capacidade é potência de 2)
+    unsigned long long head;      //total de registros gravados
+    unsigned long long tail;      //total de registros já formatados
+
+    TraceBuffer(const TraceBuffer&);
+    TraceBuffer& operator=(const TraceBuffer&);
+};
+
+inline TraceBuffer::TraceBuffer(size_t capacity) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    records = new TraceRecord[size];
+    mask    = size - 1;
+    head    = 0;
+    tail    = 0;
+    dropped = 0;
+}
+
+inline TraceBuffer::~TraceBuffer() {
+    delete[] records;
+}
+
+/* Grava a instrução prestes a ser executada (chamado antes de executá-la) */
+inline void TraceBuffer::record(const Chip8& c, word instr) {
+    TraceRecord& r = records[head & mask];
+    r.pc    = c.PC;
+    r.instr = instr;
+    r.I     = c.I;
+    r.SP    = c.SP;
+    memcpy(r.V, c.V, sizeof(r.V));
+    head++;
+}
+
+/* Formata os registros pendentes em texto e esvazia o buffer */
+inline void TraceBuffer::flush(FILE* out) {
+    if (head - tail > mask + 1) {
+        unsigned long long lost = head - tail - (mask + 1);
+        dropped += lost;
+        tail += lost;
+        fprintf(out, "... %llu instructions not traced (buffer full)\n", lost);
+    }
+
+    char text[32];
+    for (; tail < head; tail++) {
+        const TraceRecord& r = records[tail & mask];
+        printRegisters(out, r.V, r.I, r.SP);
+        disassemble(r.instr, text, sizeof(text));
+        fprintf(out, "$%.4x\t%s\n", r.pc, text);
+    }
+}
+
+//arquivo de rastreamento binário
+const char     traceMagic[4] = {'C', '8', 'T', 'R'};
+const word     traceVersion  = 1;
+const unsigned traceKeyframe = 4096;  //instruções entre registros com todos os registradores
+
+//flags de um registro do arquivo
+enum {
+    TRACE_REG       = 0x01, //reg/value: registrador (exceto VF) alterado pela instrução
+    TRACE_VF        = 0x02, //vf: novo valor de VF
+    TRACE_ALL_REGS  = 0x04, //segue uma extensão com os novos V0-VE
+    TRACE_DISPLAY   = 0x08, //seguem 'rows' extensões com o XOR das linhas da tela
+    TRACE_EXTENSION = 0x80  //este registro é uma extensão do anterior
+};
+
+/* Cabeçalho do arquivo */
+struct TraceFileHeader {
+    char magic[4];                //"C8TR"
+    word version;
+    word recordSize;              //sizeof(TraceFileRecord)
+    byte flags;                   //TRACE_DISPLAY se a tela é registrada
+    byte rows;                    //linhas da tela já acesas (extensões logo após o cabeçalho)
+    byte reserved[6];
+    byte V[16];                   //registradores antes da primeira instrução
+};
+
+/* Registro de uma instrução */
+struct TraceFileRecord {
+    byte flags;
+    byte SP;                      //antes da instrução
+    word pc;
+    word instr;
+    word I;                       //antes da instrução
+    byte reg;                     //com TRACE_REG
+    byte value;                   //com TRACE_REG
+    byte vf;                      //com TRACE_VF
+    byte rows;                    //com TRACE_DISPLAY
+    byte reserved[4];
+};
+
+/* Extensões: todos os registradores ou uma linha da tela */
+struct TraceRegsExtension {
+    byte flags;                   //TRACE_EXTENSION | TRACE_ALL_REGS
+    byte V[15];                   //V0-VE (VF está no registro principal)
+};
+
+struct TraceDisplayExtension {
+    byte     flags;               //TRACE_EXTENSION | TRACE_DISPLAY
+    byte     row;
+    byte     reserved[6];
+    uint64_t diff;                //XOR entre a linha nova e a anterior
+};
+
+/* Gravação do rastreamento em arquivo (política de rastreamento para o interpretador) */
+class TraceFile {
+public:
+    static const bool enabled = true;
+
+    TraceFile();
+    ~TraceFile();
+
+    bool open(const char* filename, const Chip8& c, bool withDisplay);
+    void record(const Chip8& c, word instr);
+    void close(const Chip8& c);
+
+private:
+    int    fd;
+    byte*  map;
+    size_t mapped;                //bytes mapeados (o arquivo cresce em blocos)
+    size_t size;                  //bytes escritos
+    bool   withDisplay;
+
+    //instrução gravada por último, que aguarda o resultado para ser escrita
+    bool               pending;
+    TraceFileRecord    last;
+    unsigned long long count;
+    byte               lastV[16];
+    uint64_t           lastDisplay[displayHeight];
+
+    void write(const void* data, size_t length);
+    void finish(const Chip8& c);
+
+    TraceFile(const TraceFile&);
+    TraceFile& operator=(const TraceFile&);
+};
+
+inline TraceFile::TraceFile() : fd(-1), map(NULL), mapped(0), size(0), withDisplay(false), pending(false), count(0) {
+}
+
+inline TraceFile::~TraceFile() {
+    if (fd >= 0) {
+        if (map != NULL) {
+            munmap(map, mapped);
+        }
+        if (ftruncate(fd, size) != 0) {
+            perror("trace");
+        }
+        ::close(fd);
+    }
+}
+
+/* Cria o arquivo e grava o cabeçalho com o estado atual da máquina */
+inline bool TraceFile::open(const char* filename, const Chip8& c, bool display) {
+    fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Couldn't create trace file: %s\n", filename);
+        return false;
+    }
+
+    withDisplay = display;
+    pending = false;
+    count = 0;
+    memcpy(lastV, c.V, sizeof(lastV));
+    memcpy(lastDisplay, c.display, sizeof(lastDisplay));
+
+    TraceFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, traceMagic, sizeof(header.magic));
+    header.version    = traceVersion;
+    header.recordSize = sizeof(TraceFileRecord);
+    header.flags      = withDisplay ? TRACE_DISPLAY : 0;
+    memcpy(header.V, c.V, sizeof(header.V));
+
+    if (withDisplay) {
+        for (int i = 0; i < displayHeight; i++) {
+            header.rows += (c.display[i] != 0);
+        }
+    }
+    write(&header, sizeof(header));
+
+    //tela inicial, como diferença em relação a uma tela apagada
+    for (int i = 0; withDisplay && i < displayHeight; i++) {
+        if (c.display[i] != 0) {
+            TraceDisplayExtension ext;
+            memset(&ext, 0, sizeof(ext));
+            ext.diff  = c.display[i];
+            ext.flags = TRACE_EXTENSION | TRACE_DISPLAY;
+            ext.row   = i;
+            write(&ext, sizeof(ext));
+        }
+    }
+
+    return fd >= 0;
+}
+
+/* Acrescenta dados ao arquivo, aumentando a região mapeada quando necessário */
+inline void TraceFile::write(const void* data, size_t length) {
+    if (fd < 0) {
+        return;
+    }
+
+    if (size + length > mapped) {
+        size_t grown = (mapped == 0) ? (1 << 20) : mapped * 2;
+        if (map != NULL) {
+            munmap(map, mapped);
+        }
+        map = NULL;
+        if (ftruncate(fd, grown) == 0) {
+            void* region = mmap(NULL, grown, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (region != MAP_FAILED) {
+                map = (byte*) region;
+                mapped = grown;
+            }
+        }
+        if (map == NULL) {
+            printf("Couldn't grow trace file, tracing stopped\n");
+            ::close(fd);
+            fd = -1;
+            return;
+        }
+    }
+
+    memcpy(map + size, data, length);
+    size += length;
+}
+
+/* Completa a instrução pendente com o que ela alterou na máquina e a escreve */
+inline void TraceFile::finish(const Chip8& c) {
+    int changed = 0, changedReg = 0;
+    for (int i = 0; i < 0xF; i++) {
+        if (c.V[i] != lastV[i]) {
+            changed++;
+            changedReg = i;
+        }
+    }
+
+    bool keyframe = (count % traceKeyframe) == 0;
+    if (changed == 1 && !keyframe) {
+        last.flags |= TRACE_REG;
+        last.reg    = changedReg;
+        last.value  = c.V[changedReg];
+    } else if (changed > 1 || keyframe) {
+        last.flags |= TRACE_ALL_REGS;
+    }
+    if (c.V[0xF] != lastV[0xF] || (last.flags & TRACE_ALL_REGS)) {
+        last.flags |= TRACE_VF;
+        last.vf     = c.V[0xF];
+    }
+
+    //só CLS e DRW alteram a tela
+    byte op = opIndex(last.instr);
+    if (withDisplay && (op == OP_CLS || op == OP_DRW)) {
+        for (int i = 0; i < displayHeight; i++) {
+            last.rows += (c.display[i] != lastDisplay[i]);
+        }
+        if (last.rows > 0) {
+            last.flags |= TRACE_DISPLAY;
+        }
+    }
+
+    write(&last, sizeof(last));
+
+    if (last.flags & TRACE_ALL_REGS) {
+        TraceRegsExtension ext;
+        memcpy(ext.V, c.V, sizeof(ext.V));
+        ext.flags = TRACE_EXTENSION | TRACE_ALL_REGS;
+        write(&ext, sizeof(ext));
+    }
+
+    if (last.flags & TRACE_DISPLAY) {
+        for (int i = 0; i < displayHeight; i++) {
+            if (c.display[i] != lastDisplay[i]) {
+                TraceDisplayExtension ext;
+                memset(&ext, 0, sizeof(ext));
+                ext.diff  = c.display[i] ^ lastDisplay[i];
+                ext.flags = TRACE_EXTENSION | TRACE_DISPLAY;
+                ext.row   = i;
+                write(&ext, sizeof(ext));
+                lastDisplay[i] = c.display[i];
+            }
+        }
+    }
+
+    memcpy(lastV, c.V, sizeof(lastV));
+    pending = false;
+}
+
+/* Grava a instrução prestes a ser executada; ela é escrita quando a próxima começar */
+inline void TraceFile::record(const Chip8& c, word instr) {
+    if (pending) {
+        finish(c);
+    }
+
+    memset(&last, 0, sizeof(last));
+    last.pc    = c.PC;
+    last.instr = instr;
+    last.I     = c.I;
+    last.SP    = c.SP;
+    pending = true;
+    count++;
+}
+
+/* Escreve a última instrução e fecha o arquivo */
+inline void TraceFile::close(const Chip8& c) {
+    if (pending) {
+        finish(c);
+    }
+
+    if (fd >= 0) {
+        munmap(map, mapped);
+        map = NULL;
+        if (ftruncate(fd, size) != 0) {
+            perror("trace");
+        }
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+/* Uma instrução lida do arquivo, com o estado reconstruído antes dela */
+struct TraceStep {
+    unsigned long long index;     //posição da instrução no rastreamento
+    word     pc;
+    word     instr;
+    word     I;
+    word     SP;
+    byte     V[16];
+    int      rows;                //linhas da tela alteradas pela instrução
+    byte     row[displayHeight];
+    uint64_t diff[displayHeight];
+};
+
+/* Leitura de um arquivo de rastreamento (mapeado em memória) */
+class TraceReader {
+public:
+    TraceFileHeader header;
+    uint64_t        display[displayHeight];  //tela após a última instrução lida (com TRACE_DISPLAY)
+
+    TraceReader() : map(NULL), size(0), pos(0), index(0) {}
+    ~TraceReader();
+
+    bool open(const char* filename);
+    bool next(TraceStep& step);
+
+private:
+    const byte*        map;
+    size_t             size;
+    size_t             pos;
+    unsigned long long index;
+    byte               V[16];     //registradores antes da próxima instrução
+
+    TraceReader(const TraceReader&);
+    TraceReader& operator=(const TraceReader&);
+};
+
+inline TraceReader::~TraceReader() {
+    if (map != NULL) {
+        munmap((void*) map, size);
+    }
+}
+
+/* Abre e valida o arquivo */
+inline bool TraceReader::open(const char* filename) {
+    int fd = ::open(filename, O_RDONLY);
+    if (fd < 0) {
+        printf("Couldn't open trace file: %s\n", filename);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(header)) {
+        printf("Invalid trace file: %s\n", filename);
+        ::close(fd);
+        return false;
+    }
+
+    size = st.st_size;
+    void* region = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (region == MAP_FAILED) {
+        printf("Couldn't map trace file: %s\n", filename);
+        return false;
+    }
+    map = (const byte*) region;
+
+    memcpy(&header, map, sizeof(header));
+    if (memcmp(header.magic, traceMagic, sizeof(header.magic)) != 0 || header.version != traceVersion ||
+        header.recordSize != sizeof(TraceFileRecord)) {
+        printf("Invalid trace file: %s\n", filename);
+        return false;
+    }
+
+    memcpy(V, header.V, sizeof(V));
+    memset(display, 0, sizeof(display));
+    pos = sizeof(header);
+    index = 0;
+
+    //tela inicial
+    for (int i = 0; i < header.rows && pos + sizeof(TraceDisplayExtension) <= size; i++) {
+        TraceDisplayExtension ext;
+        memcpy(&ext, map + pos, sizeof(ext));
+        display[ext.row % displayHeight] ^= ext.diff;
+        pos += sizeof(ext);
+    }
+    return true;
+}
+
+/* Lê a próxima instrução; devolve false no fim do arquivo */
+inline bool TraceReader::next(TraceStep& step) {
+    if (map == NULL || pos + sizeof(TraceFileRecord) > size) {
+        return false;
+    }
+
+    TraceFileRecord r;
+    memcpy(&r, map + pos, sizeof(r));
+    pos += sizeof(r);
+
+    step.index = index++;
+    step.pc    = r.pc;
+    step.instr = r.instr;
+    step.I     = r.I;
+    step.SP    = r.SP;
+    step.rows  = 0;
+    memcpy(step.V, V, sizeof(V));
+
+    //aplica as alterações da instrução, que valem a partir da próxima
+    if (r.flags & TRACE_REG) {
+        V[r.reg & 0xF] = r.value;
+    }
+    if (r.flags & TRACE_VF) {
+        V[0xF] = r.vf;
+    }
+
+    //extensões que seguem o registro
+    while (pos + 16 <= size && (map[pos] & TRACE_EXTENSION)) {
+        byte flags = map[pos];
+        if (flags & TRACE_ALL_REGS) {
+            TraceRegsExtension ext;
+            memcpy(&ext, map + pos, sizeof(ext));
+            memcpy(V, ext.V, sizeof(ext.V));
+        } else if ((flags & TRACE_DISPLAY) && step.rows < displayHeight) {
+            TraceDisplayExtension ext;
+            memcpy(&ext, map + pos, sizeof(ext));
+            step.row[step.rows]  = ext.row % displayHeight;
+            step.diff[step.rows] = ext.diff;
+            display[step.row[step.rows]] ^= ext.diff;
+            step.rows++;
+        }
+        pos += 16;
+    }
+
+    return true;
+}
+
+#endif
@@ -0,0 +1,62 @@
+/****************************************************************************
+  Buffer triplo sem travas, para passar quadros de uma thread para outra.
+
+  O escritor (a thread de emulação) preenche writeBuffer() e chama publish();
+  o leitor (a thread que desenha) chama update() e, se houver um quadro novo,
+  lê readBuffer(). Cada lado tem o seu buffer e o terceiro fica no meio: publish()
+  troca o buffer do escritor pelo do meio, update() troca o do leitor pelo do
+  meio, ambos com uma única troca atômica. Nenhum lado espera pelo outro: o
+  escritor pode publicar quantos quadros quiser (o leitor vê sempre o mais
+  recente) e o leitor pode reler o mesmo quadro quantas vezes quiser.
+*****************************************************************************/
+
+#ifndef CHIP8_TRIPLEBUFFER_H
+#define CHIP8_TRIPLEBUFFER_H
+
+#include <atomic>
+
+template <class T>
+class TripleBuffer {
+public:
+    TripleBuffer() : middle(1), front(0), back(2) {}
+
+    //escritor
+    T&   writeBuffer() { return slots[back].value; }
+    void publish();
+
+    //leitor
+    bool     update();
+    const T& readBuffer() const { return slots[front].value; }
+
+private:
+    static const int freshBit  = 4;   //o buffer do meio tem um quadro que o leitor ainda não pegou
+    static const int indexMask = 3;
+
+    //um buffer por linha de cache: escritor e leitor não disputam as mesmas linhas
+    struct alignas(64) Slot {
+        T value;
+    };
+
+    Slot             slots[3];
+    std::atomic<int> middle;          //índice do buffer do meio, com freshBit
+    int              front;           //buffer do leitor
+    int              back;            //buffer do escritor
+};
+
+/* Entrega o quadro escrito e passa a escrever no buffer que estava no meio */
+template <class T>
+inline void TripleBuffer<T>::publish() {
+    back = middle.exchange(back | freshBit, std::memory_order_acq_rel) & indexMask;
+}
+
+/* Pega o quadro mais recente, se houver um novo; retorna false se não houver */
+template <class T>
+inline bool TripleBuffer<T>::update() {
+    if (!(middle.load(std::memory_order_relaxed) & freshBit)) {
+        return false;
+    }
+    front = middle.exchange(front, std::memory_order_acq_rel) & indexMask;
+    return true;
+}
+
+#endif